@@ -26,19 +26,31 @@
 #include "gom-application.h"
 #include "gom-dbus.h"
 #include "gom-miner.h"
+#include "gom-utils.h"
 
 #define AUTOQUIT_TIMEOUT 5 /* seconds */
+#define DISPLAY_NAME_CACHE "display-names"
 
-struct _GomApplication
+typedef struct
 {
-  GApplication parent;
-  GCancellable *cancellable;
+  GomApplication *application;
   GError *miner_error;
   GomDBus *skeleton;
   GomMiner *miner;
+  GList *refreshing;
+  GQueue *pending;
   GQueue *queue;
   GType miner_type;
-  gboolean refreshing;
+  gchar *bus_name;
+  guint owner_id;
+} GomApplicationMiner;
+
+struct _GomApplication
+{
+  GApplication parent;
+  GCancellable *cancellable;
+  GPtrArray *miners;
+  GType miner_type;
 };
 
 struct _GomApplicationClass
@@ -55,6 +67,56 @@ enum
 G_DEFINE_TYPE (GomApplication, gom_application, G_TYPE_APPLICATION);
 
 static void gom_application_refresh_db_cb (GObject *source, GAsyncResult *res, gpointer user_data);
+static gboolean gom_application_insert_shared_content (GomApplicationMiner *app_miner,
+                                                       GDBusMethodInvocation *invocation,
+                                                       const gchar *account_id,
+                                                       const gchar *shared_id,
+                                                       const gchar *shared_type,
+                                                       const gchar *source_urn);
+static gboolean gom_application_insert_shared_content_batch (GomApplicationMiner *app_miner,
+                                                             GDBusMethodInvocation *invocation,
+                                                             const gchar *account_id,
+                                                             const gchar *const *shared_ids,
+                                                             const gchar *shared_type,
+                                                             const gchar *source_urn);
+
+static GomApplicationMiner *
+gom_application_lookup_miner (GomApplication *self, GomMiner *miner)
+{
+  guint i;
+
+  for (i = 0; i < self->miners->len; i++)
+    {
+      GomApplicationMiner *app_miner = g_ptr_array_index (self->miners, i);
+
+      if (app_miner->miner == miner)
+        return app_miner;
+    }
+
+  g_assert_not_reached ();
+  return NULL;
+}
+
+static void
+gom_application_miner_free (GomApplicationMiner *app_miner)
+{
+  g_clear_object (&app_miner->miner);
+  g_clear_object (&app_miner->skeleton);
+  g_clear_error (&app_miner->miner_error);
+
+  if (app_miner->pending != NULL)
+    g_queue_free_full (app_miner->pending, g_object_unref);
+
+  if (app_miner->queue != NULL)
+    g_queue_free_full (app_miner->queue, g_object_unref);
+
+  /* the pending callbacks own the invocations */
+  g_list_free (app_miner->refreshing);
+
+  g_free (app_miner->bus_name);
+
+  g_slice_free (GomApplicationMiner, app_miner);
+}
 
 static void
 gom_application_insert_shared_content_cb (GObject *source,
@@ -62,12 +124,15 @@ gom_application_insert_shared_content_cb (GObject *source,
                                           gpointer user_data)
 {
   GomApplication *self;
+  GomApplicationMiner *app_miner;
   GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
   GError *error;
 
   self = GOM_APPLICATION (g_application_get_default ());
   g_application_release (G_APPLICATION (self));
 
+  app_miner = gom_application_lookup_miner (self, GOM_MINER (source));
+
   error = NULL;
   if (!gom_miner_insert_shared_content_finish (GOM_MINER (source), res, &error))
     {
@@ -76,28 +141,37 @@ gom_application_insert_shared_content_cb (GObject *source,
       goto out;
     }
 
-  gom_dbus_complete_insert_shared_content (self->skeleton, invocation);
+  gom_dbus_complete_insert_shared_content (app_miner->skeleton, invocation);
 
  out:
   g_object_unref (invocation);
 }
 
 static gboolean
-gom_application_insert_shared_content (GomApplication *self,
+gom_application_insert_shared_content (GomApplicationMiner *app_miner,
                                        GDBusMethodInvocation *invocation,
                                        const gchar *account_id,
                                        const gchar *shared_id,
                                        const gchar *shared_type,
                                        const gchar *source_urn)
 {
-  if (G_UNLIKELY (self->miner == NULL))
+  GomApplication *self = app_miner->application;
+
+  if (G_UNLIKELY (app_miner->miner_error != NULL))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, app_miner->miner_error);
+      goto out;
+    }
+
+  /* replayed once the miner is initialized */
+  if (app_miner->miner == NULL)
     {
-      g_dbus_method_invocation_return_gerror (invocation, self->miner_error);
+      g_queue_push_tail (app_miner->pending, g_object_ref (invocation));
       goto out;
     }
 
   g_application_hold (G_APPLICATION (self));
-  gom_miner_insert_shared_content_async (self->miner,
+  gom_miner_insert_shared_content_async (app_miner->miner,
                                          account_id,
                                          shared_id,
                                          shared_type,
@@ -111,32 +185,150 @@ gom_application_insert_shared_content (GomApplication *self,
 }
 
 static void
-gom_application_process_queue (GomApplication *self)
+gom_application_insert_shared_content_batch_cb (GObject *source,
+                                                GAsyncResult *res,
+                                                gpointer user_data)
 {
-  GDBusMethodInvocation *invocation = NULL;
-  const gchar **index_types;
+  GomApplication *self;
+  GomApplicationMiner *app_miner;
+  GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+  GError *error;
 
-  g_assert (GOM_IS_MINER (self->miner));
+  self = GOM_APPLICATION (g_application_get_default ());
+  g_application_release (G_APPLICATION (self));
 
-  if (self->refreshing)
-    goto out;
+  app_miner = gom_application_lookup_miner (self, GOM_MINER (source));
 
-  if (g_queue_is_empty (self->queue))
-    goto out;
+  error = NULL;
+  if (!gom_miner_insert_shared_content_batch_finish (GOM_MINER (source), res, &error))
+    {
+      g_printerr ("Failed to insert shared content: %s\n", error->message);
+      g_dbus_method_invocation_take_error (invocation, error);
+      goto out;
+    }
+
+  gom_dbus_complete_insert_shared_content_batch (app_miner->skeleton, invocation);
+
+ out:
+  g_object_unref (invocation);
+}
+
+static gboolean
+gom_application_insert_shared_content_batch (GomApplicationMiner *app_miner,
+                                             GDBusMethodInvocation *invocation,
+                                             const gchar *account_id,
+                                             const gchar *const *shared_ids,
+                                             const gchar *shared_type,
+                                             const gchar *source_urn)
+{
+  GomApplication *self = app_miner->application;
 
-  invocation = G_DBUS_METHOD_INVOCATION (g_queue_pop_head (self->queue));
-  index_types = g_object_get_data (G_OBJECT (invocation), "index-types");
-  gom_miner_set_index_types (self->miner, index_types);
+  if (G_UNLIKELY (app_miner->miner_error != NULL))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, app_miner->miner_error);
+      goto out;
+    }
+
+  /* replayed once the miner is initialized */
+  if (app_miner->miner == NULL)
+    {
+      g_queue_push_tail (app_miner->pending, g_object_ref (invocation));
+      goto out;
+    }
 
-  self->refreshing = TRUE;
   g_application_hold (G_APPLICATION (self));
-  gom_miner_refresh_db_async (self->miner,
-                              self->cancellable,
-                              gom_application_refresh_db_cb,
-                              g_object_ref (invocation));
+  gom_miner_insert_shared_content_batch_async (app_miner->miner,
+                                               account_id,
+                                               (const gchar **) shared_ids,
+                                               shared_type,
+                                               source_urn,
+                                               self->cancellable,
+                                               gom_application_insert_shared_content_batch_cb,
+                                               g_object_ref (invocation));
 
  out:
-  g_clear_object (&invocation);
+  return TRUE;
+}
+
+static gboolean
+gom_application_index_types_overlap (GDBusMethodInvocation *a, GDBusMethodInvocation *b)
+{
+  const gchar **index_types_a;
+  const gchar **index_types_b;
+  guint i;
+
+  index_types_a = g_object_get_data (G_OBJECT (a), "index-types");
+  index_types_b = g_object_get_data (G_OBJECT (b), "index-types");
+
+  for (i = 0; index_types_a[i] != NULL; i++)
+    {
+      if (gom_miner_supports_type (index_types_b, index_types_a[i]))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+gom_application_overlaps_any (GDBusMethodInvocation *invocation, GList *invocations)
+{
+  GList *l;
+
+  for (l = invocations; l != NULL; l = l->next)
+    {
+      if (gom_application_index_types_overlap (invocation, G_DBUS_METHOD_INVOCATION (l->data)))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+gom_application_process_queue (GomApplicationMiner *app_miner)
+{
+  GomApplication *self = app_miner->application;
+  GList *l;
+  GList *next;
+  GList *waiting = NULL;
+
+  if (app_miner->miner == NULL)
+    return;
+
+  /* Each refresh carries its own index types, so the ones that don't
+   * overlap can run alongside each other. Those that do are kept in
+   * the order in which they were requested.
+   */
+  for (l = app_miner->queue->head; l != NULL; l = next)
+    {
+      GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (l->data);
+      const gchar **index_types;
+      gboolean force;
+
+      next = l->next;
+
+      if (gom_application_overlaps_any (invocation, app_miner->refreshing)
+          || gom_application_overlaps_any (invocation, waiting))
+        {
+          waiting = g_list_prepend (waiting, invocation);
+          continue;
+        }
+
+      g_queue_delete_link (app_miner->queue, l);
+      app_miner->refreshing = g_list_prepend (app_miner->refreshing, invocation);
+
+      index_types = g_object_get_data (G_OBJECT (invocation), "index-types");
+      force = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (invocation), "force"));
+
+      g_application_hold (G_APPLICATION (self));
+      gom_miner_refresh_db_async (app_miner->miner,
+                                  index_types,
+                                  force,
+                                  self->cancellable,
+                                  gom_application_refresh_db_cb,
+                                  invocation);
+    }
+
+  g_list_free (waiting);
 }
 
 static void
@@ -145,12 +337,15 @@ gom_application_refresh_db_cb (GObject *source,
                                gpointer user_data)
 {
   GomApplication *self;
+  GomApplicationMiner *app_miner;
   GDBusMethodInvocation *invocation = user_data;
   GError *error = NULL;
 
   self = GOM_APPLICATION (g_application_get_default ());
   g_application_release (G_APPLICATION (self));
-  self->refreshing = FALSE;
+
+  app_miner = gom_application_lookup_miner (self, GOM_MINER (source));
+  app_miner->refreshing = g_list_remove (app_miner->refreshing, invocation);
 
   gom_miner_refresh_db_finish (GOM_MINER (source), res, &error);
   if (error != NULL)
@@ -160,33 +355,180 @@ gom_application_refresh_db_cb (GObject *source,
       goto out;
     }
 
-  gom_dbus_complete_refresh_db (self->skeleton, invocation);
+  /* this completes both RefreshDB and RefreshDBWithOptions */
+  g_dbus_method_invocation_return_value (invocation, NULL);
 
  out:
   g_object_unref (invocation);
-  gom_application_process_queue (self);
+  gom_application_process_queue (app_miner);
+}
+
+static void
+gom_application_queue_refresh_db (GomApplicationMiner *app_miner,
+                                  GDBusMethodInvocation *invocation,
+                                  const gchar *const *arg_index_types,
+                                  gboolean force)
+{
+  gchar **index_types;
+
+  if (G_UNLIKELY (app_miner->miner_error != NULL))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, app_miner->miner_error);
+      return;
+    }
+
+  index_types = g_strdupv ((gchar **) arg_index_types);
+  g_object_set_data_full (G_OBJECT (invocation), "index-types", index_types, (GDestroyNotify) g_strfreev);
+  g_object_set_data (G_OBJECT (invocation), "force", GINT_TO_POINTER (force));
+  g_queue_push_tail (app_miner->queue, g_object_ref (invocation));
+  gom_application_process_queue (app_miner);
 }
 
 static gboolean
-gom_application_refresh_db (GomApplication *self,
+gom_application_refresh_db (GomApplicationMiner *app_miner,
                             GDBusMethodInvocation *invocation,
                             const gchar *const *arg_index_types)
 {
-  gchar **index_types;
+  gom_application_queue_refresh_db (app_miner, invocation, arg_index_types, FALSE);
+  return TRUE;
+}
+
+static gboolean
+gom_application_refresh_db_with_options (GomApplicationMiner *app_miner,
+                                         GDBusMethodInvocation *invocation,
+                                         const gchar *const *arg_index_types,
+                                         GVariant *arg_options)
+{
+  gboolean force = FALSE;
+
+  g_variant_lookup (arg_options, "force", "b", &force);
+  gom_application_queue_refresh_db (app_miner, invocation, arg_index_types, force);
+  return TRUE;
+}
+
+static gchar *
+gom_application_load_display_name (GType miner_type)
+{
+  GKeyFile *key_file;
+  gchar *display_name;
+
+  key_file = gom_cache_key_file_load (DISPLAY_NAME_CACHE);
+  display_name = g_key_file_get_string (key_file, g_type_name (miner_type), "DisplayName", NULL);
+  g_key_file_unref (key_file);
+
+  return display_name;
+}
+
+static void
+gom_application_save_display_name (GType miner_type, const gchar *display_name)
+{
+  GKeyFile *key_file;
+  GError *error = NULL;
+  gchar *cached;
 
-  if (G_UNLIKELY (self->miner == NULL))
+  key_file = gom_cache_key_file_load (DISPLAY_NAME_CACHE);
+
+  cached = g_key_file_get_string (key_file, g_type_name (miner_type), "DisplayName", NULL);
+  if (g_strcmp0 (cached, display_name) == 0)
+    goto out;
+
+  g_key_file_set_string (key_file, g_type_name (miner_type), "DisplayName", display_name);
+  if (!gom_cache_key_file_save (key_file, DISPLAY_NAME_CACHE, &error))
     {
-      g_dbus_method_invocation_return_gerror (invocation, self->miner_error);
+      g_warning ("Unable to cache the display name: %s", error->message);
+      g_error_free (error);
+    }
+
+ out:
+  g_free (cached);
+  g_key_file_unref (key_file);
+}
+
+static void
+gom_application_miner_init_cb (GObject *source,
+                               GAsyncResult *res,
+                               gpointer user_data)
+{
+  GomApplicationMiner *app_miner = user_data;
+  GomApplication *self = app_miner->application;
+  GDBusMethodInvocation *invocation;
+  GObject *miner;
+
+  miner = g_async_initable_new_finish (G_ASYNC_INITABLE (source), res, &app_miner->miner_error);
+  if (G_UNLIKELY (miner == NULL))
+    {
+      g_printerr ("Failed to initialize the miner: %s\n", app_miner->miner_error->message);
+
+      while ((invocation = g_queue_pop_head (app_miner->pending)) != NULL)
+        {
+          g_dbus_method_invocation_return_gerror (invocation, app_miner->miner_error);
+          g_object_unref (invocation);
+        }
+
+      while ((invocation = g_queue_pop_head (app_miner->queue)) != NULL)
+        {
+          g_dbus_method_invocation_return_gerror (invocation, app_miner->miner_error);
+          g_object_unref (invocation);
+        }
+
       goto out;
     }
 
-  index_types = g_strdupv ((gchar **) arg_index_types);
-  g_object_set_data_full (G_OBJECT (invocation), "index-types", index_types, (GDestroyNotify) g_strfreev);
-  g_queue_push_tail (self->queue, g_object_ref (invocation));
-  gom_application_process_queue (self);
+  app_miner->miner = GOM_MINER (miner);
+
+  gom_dbus_set_display_name (app_miner->skeleton, gom_miner_get_display_name (app_miner->miner));
+  gom_application_save_display_name (app_miner->miner_type, gom_miner_get_display_name (app_miner->miner));
+
+  while ((invocation = g_queue_pop_head (app_miner->pending)) != NULL)
+    {
+      GVariant *parameters;
+      const gchar *account_id;
+      const gchar *shared_type;
+      const gchar *source_urn;
+
+      parameters = g_dbus_method_invocation_get_parameters (invocation);
+
+      if (g_strcmp0 (g_dbus_method_invocation_get_method_name (invocation), "InsertSharedContentBatch") == 0)
+        {
+          const gchar **shared_ids;
+
+          g_variant_get (parameters, "(&s^a&s&s&s)", &account_id, &shared_ids, &shared_type, &source_urn);
+          gom_application_insert_shared_content_batch (app_miner,
+                                                       invocation,
+                                                       account_id,
+                                                       shared_ids,
+                                                       shared_type,
+                                                       source_urn);
+          g_free (shared_ids);
+        }
+      else
+        {
+          const gchar *shared_id;
+
+          g_variant_get (parameters, "(&s&s&s&s)", &account_id, &shared_id, &shared_type, &source_urn);
+          gom_application_insert_shared_content (app_miner,
+                                                 invocation,
+                                                 account_id,
+                                                 shared_id,
+                                                 shared_type,
+                                                 source_urn);
+        }
+
+      g_object_unref (invocation);
+    }
+
+  gom_application_process_queue (app_miner);
 
  out:
-  return TRUE;
+  g_application_release (G_APPLICATION (self));
+}
+
+static void
+gom_application_name_lost (GDBusConnection *connection,
+                           const gchar *name,
+                           gpointer user_data)
+{
+  g_warning ("Unable to own %s, is another miner already running?", name);
 }
 
 static gboolean
@@ -197,6 +539,7 @@ gom_application_dbus_register (GApplication *application,
 {
   GomApplication *self = GOM_APPLICATION (application);
   gboolean retval = FALSE;
+  guint i;
 
   if (!G_APPLICATION_CLASS (gom_application_parent_class)->dbus_register (application,
                                                                           connection,
@@ -204,11 +547,48 @@ gom_application_dbus_register (GApplication *application,
                                                                           error))
     goto out;
 
-  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (self->skeleton),
-                                         connection,
-                                         object_path,
-                                         error))
-    goto out;
+  for (i = 0; i < self->miners->len; i++)
+    {
+      GomApplicationMiner *app_miner = g_ptr_array_index (self->miners, i);
+      gboolean exported;
+
+      /* A miner without a bus name of its own lives at the
+       * application's object path, otherwise it uses the object path
+       * that its own stand-alone process would have used.
+       */
+      if (app_miner->bus_name == NULL)
+        {
+          exported = g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (app_miner->skeleton),
+                                                       connection,
+                                                       object_path,
+                                                       error);
+        }
+      else
+        {
+          gchar *miner_object_path;
+
+          miner_object_path = g_strdelimit (g_strconcat ("/", app_miner->bus_name, NULL), ".", '/');
+          exported = g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (app_miner->skeleton),
+                                                       connection,
+                                                       miner_object_path,
+                                                       error);
+          g_free (miner_object_path);
+        }
+
+      if (!exported)
+        goto out;
+
+      if (app_miner->bus_name != NULL)
+        {
+          app_miner->owner_id = g_bus_own_name_on_connection (connection,
+                                                              app_miner->bus_name,
+                                                              G_BUS_NAME_OWNER_FLAGS_NONE,
+                                                              NULL,
+                                                              gom_application_name_lost,
+                                                              NULL,
+                                                              NULL);
+        }
+    }
 
   retval = TRUE;
 
@@ -222,11 +602,20 @@ gom_application_dbus_unregister (GApplication *application,
                                  const gchar *object_path)
 {
   GomApplication *self = GOM_APPLICATION (application);
+  guint i;
 
-  if (self->skeleton != NULL)
+  for (i = 0; i < self->miners->len; i++)
     {
-      if (g_dbus_interface_skeleton_has_connection (G_DBUS_INTERFACE_SKELETON (self->skeleton), connection))
-        g_dbus_interface_skeleton_unexport_from_connection (G_DBUS_INTERFACE_SKELETON (self->skeleton),
+      GomApplicationMiner *app_miner = g_ptr_array_index (self->miners, i);
+
+      if (app_miner->owner_id != 0)
+        {
+          g_bus_unown_name (app_miner->owner_id);
+          app_miner->owner_id = 0;
+        }
+
+      if (g_dbus_interface_skeleton_has_connection (G_DBUS_INTERFACE_SKELETON (app_miner->skeleton), connection))
+        g_dbus_interface_skeleton_unexport_from_connection (G_DBUS_INTERFACE_SKELETON (app_miner->skeleton),
                                                             connection);
     }
 
@@ -250,14 +639,9 @@ gom_application_constructed (GObject *object)
 
   G_OBJECT_CLASS (gom_application_parent_class)->constructed (object);
 
-  self->miner = g_initable_new (self->miner_type, NULL, &self->miner_error, NULL);
-  if (G_LIKELY (self->miner != NULL))
-    {
-      const gchar *display_name;
-
-      display_name = gom_miner_get_display_name (self->miner);
-      gom_dbus_set_display_name (self->skeleton, display_name);
-    }
+  /* a combined application adds its miners later */
+  if (self->miner_type != GOM_TYPE_MINER)
+    gom_application_add_miner (self, NULL, self->miner_type);
 }
 
 static void
@@ -266,28 +650,11 @@ gom_application_dispose (GObject *object)
   GomApplication *self = GOM_APPLICATION (object);
 
   g_clear_object (&self->cancellable);
-  g_clear_object (&self->miner);
-  g_clear_object (&self->skeleton);
-
-  if (self->queue != NULL)
-    {
-      g_queue_free_full (self->queue, g_object_unref);
-      self->queue = NULL;
-    }
+  g_clear_pointer (&self->miners, g_ptr_array_unref);
 
   G_OBJECT_CLASS (gom_application_parent_class)->dispose (object);
 }
 
-static void
-gom_application_finalize (GObject *object)
-{
-  GomApplication *self = GOM_APPLICATION (object);
-
-  g_clear_error (&self->miner_error);
-
-  G_OBJECT_CLASS (gom_application_parent_class)->finalize (object);
-}
-
 static void
 gom_application_set_property (GObject *object,
                               guint prop_id,
@@ -312,15 +679,7 @@ static void
 gom_application_init (GomApplication *self)
 {
   self->cancellable = g_cancellable_new ();
-
-  self->skeleton = gom_dbus_skeleton_new ();
-  g_signal_connect_swapped (self->skeleton,
-                            "handle-insert-shared-content",
-                            G_CALLBACK (gom_application_insert_shared_content),
-                            self);
-  g_signal_connect_swapped (self->skeleton, "handle-refresh-db", G_CALLBACK (gom_application_refresh_db), self);
-
-  self->queue = g_queue_new ();
+  self->miners = g_ptr_array_new_with_free_func ((GDestroyNotify) gom_application_miner_free);
 }
 
 static void
@@ -331,7 +690,6 @@ gom_application_class_init (GomApplicationClass *klass)
 
   oclass->constructed = gom_application_constructed;
   oclass->dispose = gom_application_dispose;
-  oclass->finalize = gom_application_finalize;
   oclass->set_property = gom_application_set_property;
   application_class->dbus_register = gom_application_dbus_register;
   application_class->dbus_unregister = gom_application_dbus_unregister;
@@ -359,3 +717,70 @@ gom_application_new (const gchar *application_id,
                        "miner-type", miner_type,
                        NULL);
 }
+
+GApplication *
+gom_application_new_combined (const gchar *application_id)
+{
+  return g_object_new (GOM_TYPE_APPLICATION,
+                       "application-id", application_id,
+                       "flags", G_APPLICATION_IS_SERVICE,
+                       "inactivity-timeout", AUTOQUIT_TIMEOUT,
+                       NULL);
+}
+
+void
+gom_application_add_miner (GomApplication *self,
+                           const gchar *bus_name,
+                           GType miner_type)
+{
+  GomApplicationMiner *app_miner;
+  gchar *display_name;
+
+  g_return_if_fail (GOM_IS_APPLICATION (self));
+  g_return_if_fail (g_type_is_a (miner_type, GOM_TYPE_MINER));
+  g_return_if_fail (!g_application_get_is_registered (G_APPLICATION (self)));
+
+  app_miner = g_slice_new0 (GomApplicationMiner);
+  app_miner->application = self;
+  app_miner->bus_name = g_strdup (bus_name);
+  app_miner->miner_type = miner_type;
+  app_miner->pending = g_queue_new ();
+  app_miner->queue = g_queue_new ();
+
+  app_miner->skeleton = gom_dbus_skeleton_new ();
+  g_signal_connect_swapped (app_miner->skeleton,
+                            "handle-insert-shared-content",
+                            G_CALLBACK (gom_application_insert_shared_content),
+                            app_miner);
+  g_signal_connect_swapped (app_miner->skeleton,
+                            "handle-insert-shared-content-batch",
+                            G_CALLBACK (gom_application_insert_shared_content_batch),
+                            app_miner);
+  g_signal_connect_swapped (app_miner->skeleton,
+                            "handle-refresh-db",
+                            G_CALLBACK (gom_application_refresh_db),
+                            app_miner);
+  g_signal_connect_swapped (app_miner->skeleton,
+                            "handle-refresh-db-with-options",
+                            G_CALLBACK (gom_application_refresh_db_with_options),
+                            app_miner);
+
+  /* Answer DisplayName with the last known value, so that nobody has
+   * to wait for GOA and Tracker to be activated just to read it.
+   */
+  display_name = gom_application_load_display_name (miner_type);
+  if (display_name != NULL)
+    gom_dbus_set_display_name (app_miner->skeleton, display_name);
+  g_free (display_name);
+
+  /* D-Bus calls that arrive in the meantime are queued */
+  g_application_hold (G_APPLICATION (self));
+  g_async_initable_new_async (miner_type,
+                              G_PRIORITY_DEFAULT,
+                              self->cancellable,
+                              gom_application_miner_init_cb,
+                              app_miner,
+                              NULL);
+
+  g_ptr_array_add (self->miners, app_miner);
+}
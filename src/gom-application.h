@@ -57,6 +57,10 @@ GType gom_application_get_type (void);
 
 GApplication * gom_application_new (const gchar *application_id, GType miner_type);
 
+GApplication * gom_application_new_combined (const gchar *application_id);
+
+void gom_application_add_miner (GomApplication *self, const gchar *bus_name, GType miner_type);
+
 G_END_DECLS
 
 #endif /* __GOM_APPLICATION_H__ */
@@ -402,7 +402,8 @@ query_facebook (GomAccountMinerJob *job,
 
 static GHashTable *
 create_services (GomMiner *self,
-                 GoaObject *object)
+                 GoaObject *object,
+                 const gchar **index_types)
 {
   GFBGraphGoaAuthorizer *authorizer;
   GError *error = NULL;
@@ -413,7 +414,7 @@ create_services (GomMiner *self,
 
   authorizer = gfbgraph_goa_authorizer_new (object);
 
-  if (gom_miner_supports_type (self, "photos"))
+  if (gom_miner_supports_type (index_types, "photos"))
     {
       gfbgraph_authorizer_refresh_authorization (GFBGRAPH_AUTHORIZER (authorizer), NULL, &error);
       if (error != NULL)
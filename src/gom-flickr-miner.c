@@ -507,7 +507,8 @@ source_added_cb (GrlRegistry *registry, GrlSource *source, gpointer user_data)
 
 static GHashTable *
 create_services (GomMiner *self,
-                 GoaObject *object)
+                 GoaObject *object,
+                 const gchar **index_types)
 {
   GHashTable *services;
   GoaAccount *acc;
@@ -522,7 +523,7 @@ create_services (GomMiner *self,
   if (acc == NULL)
     goto out;
 
-  if (gom_miner_supports_type (self, "photos"))
+  if (gom_miner_supports_type (index_types, "photos"))
     {
       source_id = g_strdup_printf ("grl-flickr-%s", goa_account_get_id (acc));
 
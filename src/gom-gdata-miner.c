@@ -23,7 +23,11 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gdata/gdata.h>
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
 
 #include "gom-utils.h"
 #include "gom-gdata-miner.h"
@@ -31,11 +35,40 @@
 #define MINER_IDENTIFIER "gd:gdata:miner:86ec9bc9-c242-427f-aa19-77b5a2c9b6f0"
 #define PARENT_LINK_REL "http://schemas.google.com/docs/2007#parent"
 
+#define DRIVE_ABOUT_URI "https://www.googleapis.com/drive/v2/about?fields=largestChangeId"
+#define DRIVE_CHANGES_URI "https://www.googleapis.com/drive/v2/changes"
+#define DRIVE_FILES_URI "https://www.googleapis.com/drive/v2/files/"
+
+/* each account has its own cache, named ACL_ETAG_CACHE-<account id>,
+ * so that accounts refreshed at the same time don't overwrite each
+ * other's
+ */
+#define ACL_ETAG_CACHE "gdata-acl-etags"
+
+/* the SoupSession used for the Drive v2 requests that libgdata can't
+ * make, kept on the cached GDataDocumentsService of each account
+ */
+#define DRIVE_SESSION_KEY "gom-drive-session"
+
 /* used by applications to identify the source of an entry */
 #define PREFIX_DRIVE "google:drive:"
 #define PREFIX_PICASAWEB "google:picasaweb:"
 
 static const guint MAX_RESULTS = 50;
+static const guint MAX_CHANGES = 1000;
+
+/* Drive does not return more than this many files per page */
+static const gint MAX_PAGE_SIZE = 1000;
+
+/* the page size grows while a page takes less than half of this,
+ * and shrinks when it takes longer
+ */
+static const gint64 TARGET_PAGE_TIME = 2 * G_USEC_PER_SEC;
+static const guint PREFETCH_PAGES = 2;
+static const gint ACL_CONCURRENCY = 4;
+static const gint ALBUM_CONCURRENCY = 4;
+static const guint ALBUM_PAGE_SIZE = 200;
+static const gint SHARED_CONCURRENCY = 4;
 
 G_DEFINE_TYPE (GomGDataMiner, gom_gdata_miner, GOM_TYPE_MINER)
 
@@ -54,11 +87,326 @@ generate_fake_email_from_fullname (const gchar *fullname)
   return retval;
 }
 
+typedef struct {
+  GomAccountMinerJob *job;
+  TrackerSparqlConnection *connection;
+  GDataDocumentsService *service;
+  const gchar *datasource_urn;
+  GCancellable *cancellable;
+  GAsyncQueue *results;
+  GHashTable *seen;
+  GKeyFile *etags;
+  GPtrArray *requests;
+  gboolean etags_changed;
+  gchar *cache_name;
+} AclEnrichment;
+
+typedef struct {
+  GDataDocumentsEntry *entry;
+  GDataFeed *access_rules;
+  GError *error;
+  gchar *identifier;
+  gchar *resource;
+} AclRequest;
+
+static void
+acl_request_free (AclRequest *request)
+{
+  g_object_unref (request->entry);
+  g_clear_object (&request->access_rules);
+  g_clear_error (&request->error);
+  g_free (request->identifier);
+  g_free (request->resource);
+  g_slice_free (AclRequest, request);
+}
+
+static AclEnrichment *
+acl_enrichment_new (GomAccountMinerJob *job,
+                    TrackerSparqlConnection *connection,
+                    const gchar *datasource_urn,
+                    GDataDocumentsService *service,
+                    GCancellable *cancellable)
+{
+  AclEnrichment *acl;
+
+  acl = g_slice_new0 (AclEnrichment);
+  acl->job = job;
+  acl->connection = connection;
+  acl->service = service;
+  acl->datasource_urn = datasource_urn;
+  acl->cancellable = cancellable;
+  acl->results = g_async_queue_new ();
+  acl->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  acl->cache_name = g_strconcat (ACL_ETAG_CACHE "-", goa_account_get_id (job->account), NULL);
+  acl->etags = gom_cache_key_file_load (acl->cache_name);
+  acl->requests = g_ptr_array_new_with_free_func ((GDestroyNotify) acl_request_free);
+
+  return acl;
+}
+
+static void
+acl_enrichment_free (AclEnrichment *acl)
+{
+  g_async_queue_unref (acl->results);
+  g_hash_table_unref (acl->seen);
+  g_key_file_unref (acl->etags);
+  g_ptr_array_unref (acl->requests);
+  g_free (acl->cache_name);
+  g_slice_free (AclEnrichment, acl);
+}
+
+static void
+acl_enrichment_queue (AclEnrichment *acl,
+                      gboolean resource_exists,
+                      const gchar *identifier,
+                      const gchar *resource,
+                      GDataDocumentsEntry *doc_entry)
+{
+  AclRequest *request;
+  const gchar *account_id;
+  const gchar *etag;
+  gchar *cached_etag;
+
+  account_id = goa_account_get_id (acl->job->account);
+  etag = gdata_entry_get_etag (GDATA_ENTRY (doc_entry));
+
+  g_hash_table_add (acl->seen, g_strdup (identifier));
+
+  /* a resource that was just created has no contributors yet */
+  if (resource_exists && etag != NULL)
+    {
+      gboolean unchanged;
+
+      cached_etag = g_key_file_get_string (acl->etags, account_id, identifier, NULL);
+      unchanged = (g_strcmp0 (cached_etag, etag) == 0);
+      g_free (cached_etag);
+
+      if (unchanged)
+        return;
+    }
+
+  request = g_slice_new0 (AclRequest);
+  request->entry = g_object_ref (doc_entry);
+  request->identifier = g_strdup (identifier);
+  request->resource = g_strdup (resource);
+  g_ptr_array_add (acl->requests, request);
+}
+
+/* the document is gone, so is its sharing information */
+static void
+acl_enrichment_forget (AclEnrichment *acl, const gchar *identifier)
+{
+  if (g_key_file_remove_key (acl->etags, goa_account_get_id (acl->job->account), identifier, NULL))
+    acl->etags_changed = TRUE;
+}
+
+static void
+acl_enrichment_process (AclEnrichment *acl,
+                        AclRequest *request,
+                        GHashTable *contacts,
+                        GError **error)
+{
+  GList *l;
+  const gchar *etag;
+
+  if (request->error != NULL)
+    {
+      g_propagate_error (error, request->error);
+      request->error = NULL;
+      return;
+    }
+
+  for (l = gdata_feed_get_entries (request->access_rules); l != NULL; l = l->next)
+    {
+      GDataAccessRule *rule = l->data;
+      const gchar *contact_resource;
+      const gchar *scope_type;
+      const gchar *scope_value;
+
+      gdata_access_rule_get_scope (rule, &scope_type, &scope_value);
+
+      /* default scope access means the document is completely public */
+      if (g_strcmp0 (scope_type, GDATA_ACCESS_SCOPE_DEFAULT) == 0)
+        continue;
+
+      /* skip domain scopes */
+      if (g_strcmp0 (scope_type, GDATA_ACCESS_SCOPE_DOMAIN) == 0)
+        continue;
+
+      /* the same collaborators tend to show up on many documents */
+      contact_resource = g_hash_table_lookup (contacts, scope_value);
+      if (contact_resource == NULL)
+        {
+          gchar *resource;
+
+          resource = gom_tracker_utils_ensure_contact_resource (acl->connection,
+                                                                acl->cancellable, error,
+                                                                scope_value,
+                                                                "");
+          if (*error != NULL)
+            return;
+
+          g_hash_table_insert (contacts, g_strdup (scope_value), resource);
+          contact_resource = resource;
+        }
+
+      gom_tracker_sparql_connection_insert_or_replace_triple
+        (acl->connection,
+         acl->cancellable, error,
+         acl->datasource_urn, request->resource,
+         "nco:contributor", contact_resource);
+
+      if (*error != NULL)
+        return;
+    }
+
+  etag = gdata_entry_get_etag (GDATA_ENTRY (request->entry));
+  if (etag != NULL)
+    {
+      g_key_file_set_string (acl->etags,
+                             goa_account_get_id (acl->job->account),
+                             request->identifier,
+                             etag);
+      acl->etags_changed = TRUE;
+    }
+}
+
+static void
+acl_enrichment_thread_func (gpointer data,
+                            gpointer user_data)
+{
+  AclEnrichment *acl = user_data;
+  AclRequest *request = data;
+
+  if (!g_cancellable_set_error_if_cancelled (acl->cancellable, &request->error))
+    {
+      request->access_rules = gdata_access_handler_get_rules (GDATA_ACCESS_HANDLER (request->entry),
+                                                              GDATA_SERVICE (acl->service),
+                                                              acl->cancellable,
+                                                              NULL, NULL, &request->error);
+      g_atomic_int_inc (&acl->job->n_requests);
+    }
+
+  g_async_queue_push (acl->results, request);
+}
+
+/* Drops the caches of the accounts that were removed and, after a
+ * complete listing, the ETags of the documents that were not seen.
+ */
+static void
+acl_enrichment_prune (AclEnrichment *acl, gboolean complete)
+{
+  GError *error = NULL;
+  GoaClient *client;
+  const gchar *account_id;
+  gchar **names;
+  guint i;
+
+  account_id = goa_account_get_id (acl->job->account);
+  client = gom_miner_get_client (acl->job->miner);
+  names = gom_cache_list ();
+
+  for (i = 0; names[i] != NULL; i++)
+    {
+      /* the one cache that all accounts used to share goes too */
+      if (g_strcmp0 (names[i], ACL_ETAG_CACHE) != 0)
+        {
+          GoaObject *object;
+
+          if (!g_str_has_prefix (names[i], ACL_ETAG_CACHE "-"))
+            continue;
+
+          object = goa_client_lookup_by_id (client, names[i] + strlen (ACL_ETAG_CACHE "-"));
+          if (object != NULL)
+            {
+              g_object_unref (object);
+              continue;
+            }
+        }
+
+      if (!gom_cache_remove (names[i], &error))
+        {
+          g_warning ("Unable to remove the sharing ETags: %s", error->message);
+          g_clear_error (&error);
+        }
+    }
+
+  if (complete && g_key_file_has_group (acl->etags, account_id))
+    {
+      gchar **keys;
+
+      keys = g_key_file_get_keys (acl->etags, account_id, NULL, NULL);
+      for (i = 0; keys[i] != NULL; i++)
+        {
+          if (!g_hash_table_contains (acl->seen, keys[i]))
+            acl_enrichment_forget (acl, keys[i]);
+        }
+
+      g_strfreev (keys);
+    }
+
+  g_strfreev (names);
+}
+
+static void
+acl_enrichment_run (AclEnrichment *acl, gboolean complete)
+{
+  GError *error = NULL;
+  GHashTable *contacts;
+  GThreadPool *pool;
+  guint i;
+  gint max_threads;
+
+  /* This runs once the core metadata is in Tracker, so the documents
+   * show up before their sharing information does. The pool only
+   * fetches the rules, while this thread writes them, so that each
+   * contact is only looked up, and created, once.
+   */
+  if (acl->requests->len > 0)
+    {
+      contacts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+      max_threads = gom_account_miner_job_get_config_int (acl->job, "acl-concurrency", ACL_CONCURRENCY);
+      pool = g_thread_pool_new (acl_enrichment_thread_func, acl, MAX (max_threads, 1), FALSE, NULL);
+
+      for (i = 0; i < acl->requests->len; i++)
+        g_thread_pool_push (pool, g_ptr_array_index (acl->requests, i), NULL);
+
+      for (i = 0; i < acl->requests->len; i++)
+        {
+          AclRequest *request;
+
+          request = g_async_queue_pop (acl->results);
+          acl_enrichment_process (acl, request, contacts, &error);
+          if (error != NULL)
+            {
+              g_warning ("Unable to store the sharing rules of %s: %s", request->identifier, error->message);
+              g_clear_error (&error);
+            }
+        }
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+      g_hash_table_unref (contacts);
+    }
+
+  acl_enrichment_prune (acl, complete);
+
+  if (!acl->etags_changed)
+    return;
+
+  if (!gom_cache_key_file_save (acl->etags, acl->cache_name, &error))
+    {
+      g_warning ("Unable to cache the sharing ETags: %s", error->message);
+      g_error_free (error);
+    }
+}
+
 static gboolean
 account_miner_job_process_entry (TrackerSparqlConnection *connection,
                                  GHashTable *previous_resources,
                                  const gchar *datasource_urn,
-                                 GDataDocumentsService *service,
+                                 GHashTable *folders,
+                                 AclEnrichment *acl,
                                  GDataDocumentsEntry *doc_entry,
                                  GCancellable *cancellable,
                                  GError **error)
@@ -82,8 +430,6 @@ account_miner_job_process_entry (TrackerSparqlConnection *connection,
   GDataCategory *category;
   gboolean starred = FALSE;
 
-  GDataFeed *access_rules = NULL;
-
   if (GDATA_IS_DOCUMENTS_FOLDER (doc_entry))
     {
       GDataLink *link;
@@ -133,6 +479,12 @@ account_miner_job_process_entry (TrackerSparqlConnection *connection,
   if (*error != NULL)
     goto out;
 
+  if (GDATA_IS_DOCUMENTS_FOLDER (doc_entry))
+    g_hash_table_insert (folders, g_strdup (identifier), g_strdup (resource));
+
+  /* sharing changes do not touch the mtime, but they do change the ETag */
+  acl_enrichment_queue (acl, resource_exists, identifier, resource, doc_entry);
+
   new_mtime = gdata_entry_get_updated (entry);
   mtime_changed = gom_tracker_update_mtime (connection, new_mtime,
                                             resource_exists, identifier, resource,
@@ -178,28 +530,44 @@ account_miner_job_process_entry (TrackerSparqlConnection *connection,
   parents = gdata_entry_look_up_links (entry, PARENT_LINK_REL);
   for (l = parents; l != NULL; l = l->next)
     {
-      gchar *parent_resource_urn, *parent_resource_id;
+      const gchar *parent_resource_urn;
+      gchar *parent_resource_id;
 
       parent = l->data;
       parent_resource_id =
         g_strdup_printf ("gd:collection:%s%s", PREFIX_DRIVE, gdata_link_get_uri (parent));
 
-      parent_resource_urn = gom_tracker_sparql_connection_ensure_resource
-        (connection, cancellable, error,
-         NULL,
-         datasource_urn, parent_resource_id,
-         "nfo:RemoteDataObject", "nfo:DataContainer", NULL);
-      g_free (parent_resource_id);
+      /* the same few folders are the parents of most documents */
+      parent_resource_urn = g_hash_table_lookup (folders, parent_resource_id);
+      if (parent_resource_urn == NULL)
+        {
+          gchar *urn;
+
+          urn = gom_tracker_sparql_connection_ensure_resource
+            (connection, cancellable, error,
+             NULL,
+             datasource_urn, parent_resource_id,
+             "nfo:RemoteDataObject", "nfo:DataContainer", NULL);
 
-      if (*error != NULL)
-        goto out;
+          if (*error != NULL)
+            {
+              g_free (parent_resource_id);
+              goto out;
+            }
+
+          parent_resource_urn = urn;
+          g_hash_table_insert (folders, parent_resource_id, urn);
+        }
+      else
+        {
+          g_free (parent_resource_id);
+        }
 
       gom_tracker_sparql_connection_insert_or_replace_triple
         (connection,
          cancellable, error,
          datasource_urn, resource,
          "nie:isPartOf", parent_resource_urn);
-      g_free (parent_resource_urn);
 
       if (*error != NULL)
         goto out;
@@ -269,48 +637,6 @@ account_miner_job_process_entry (TrackerSparqlConnection *connection,
       g_free (contact_resource);
     }
 
-  access_rules = gdata_access_handler_get_rules (GDATA_ACCESS_HANDLER (entry),
-                                                 GDATA_SERVICE (service),
-                                                 cancellable,
-                                                 NULL, NULL, error);
-
-  if (*error != NULL)
-      goto out;
-
-  for (l = gdata_feed_get_entries (access_rules); l != NULL; l = l->next)
-    {
-      GDataAccessRule *rule = l->data;
-      const gchar *scope_type;
-      const gchar *scope_value;
-      gchar *contact_resource;
-
-      gdata_access_rule_get_scope (rule, &scope_type, &scope_value);
-
-      /* default scope access means the document is completely public */
-      if (g_strcmp0 (scope_type, GDATA_ACCESS_SCOPE_DEFAULT) == 0)
-        continue;
-
-      /* skip domain scopes */
-      if (g_strcmp0 (scope_type, GDATA_ACCESS_SCOPE_DOMAIN) == 0)
-        continue;
-
-      contact_resource = gom_tracker_utils_ensure_contact_resource (connection,
-                                                                    cancellable, error,
-                                                                    scope_value,
-                                                                    "");
-
-      gom_tracker_sparql_connection_insert_or_replace_triple
-        (connection,
-         cancellable, error,
-         datasource_urn, resource,
-         "nco:contributor", contact_resource);
-
-      g_free (contact_resource);
-
-      if (*error != NULL)
-        goto out;
-    }
-
   date = gom_iso8601_from_timestamp (gdata_entry_get_published (entry));
   gom_tracker_sparql_connection_insert_or_replace_triple
     (connection,
@@ -323,7 +649,6 @@ account_miner_job_process_entry (TrackerSparqlConnection *connection,
     goto out;
 
  out:
-  g_clear_object (&access_rules);
   g_free (resource);
   g_free (identifier);
 
@@ -626,17 +951,15 @@ account_miner_job_process_photo (TrackerSparqlConnection *connection,
   return resource;
 }
 
-static gboolean
+static gchar *
 account_miner_job_process_album (TrackerSparqlConnection *connection,
                                  GHashTable *previous_resources,
                                  const gchar *datasource_urn,
-                                 GDataPicasaWebService *service,
                                  GDataPicasaWebAlbum *album,
+                                 gboolean *out_changed,
                                  GCancellable *cancellable,
                                  GError **error)
 {
-  GDataFeed *feed = NULL;
-  GDataPicasaWebQuery *query;
   gchar *resource = NULL;
   gchar *contact_resource, *date, *identifier;
   gchar *email;
@@ -649,8 +972,6 @@ account_miner_job_process_album (TrackerSparqlConnection *connection,
   const gchar *title;
   const gchar *summary;
 
-  GList *l, *photos = NULL;
-
   GDataLink *alternate;
   const gchar *alternate_uri;
 
@@ -691,11 +1012,13 @@ account_miner_job_process_album (TrackerSparqlConnection *connection,
   if (*error != NULL)
     goto out;
 
+  *out_changed = mtime_changed;
+
   /* avoid updating the DB if the resource already exists and has not
    * been modified since our last run.
    */
   if (!mtime_changed)
-    goto album_photos;
+    goto out;
 
   /* the resource changed - just set all the properties again */
   alternate = gdata_entry_look_up_link (GDATA_ENTRY (album), GDATA_LINK_ALTERNATE);
@@ -762,52 +1085,16 @@ account_miner_job_process_album (TrackerSparqlConnection *connection,
   if (*error != NULL)
     goto out;
 
- album_photos:
-  query = gdata_picasaweb_query_new (NULL);
-  gdata_picasaweb_query_set_image_size (query, "d");
-  feed = gdata_picasaweb_service_query_files (service, album, GDATA_QUERY (query),
-                                              cancellable, NULL, NULL, error);
-
-  g_object_unref (query);
-
-  if (feed == NULL)
-    goto out;
-
-  photos = gdata_feed_get_entries (feed);
-  for (l = photos; l != NULL; l = l->next)
-    {
-      GDataPicasaWebFile *file = GDATA_PICASAWEB_FILE (l->data);
-      gchar *photo_resource_urn = NULL;
-
-      photo_resource_urn = account_miner_job_process_photo (connection,
-                                                            previous_resources,
-                                                            datasource_urn,
-                                                            file,
-                                                            resource,
-                                                            cancellable,
-                                                            error);
-
-      if (*error != NULL)
-        {
-          const gchar *photo_id;
-
-          photo_id = gdata_picasaweb_file_get_id (file);
-          g_warning ("Unable to process photo %s: %s", photo_id, (*error)->message);
-          g_clear_error (error);
-        }
-
-      g_free (photo_resource_urn);
-    }
-
  out:
-  g_clear_object (&feed);
-  g_free (resource);
   g_free (identifier);
 
   if (*error != NULL)
-    return FALSE;
+    {
+      g_free (resource);
+      return NULL;
+    }
 
-  return TRUE;
+  return resource;
 }
 
 static void
@@ -914,59 +1201,715 @@ insert_shared_content (GomMiner *miner,
                                   error);
 }
 
+typedef struct {
+  GDataPicasaWebService *service;
+  GCancellable *cancellable;
+  GAsyncQueue *results;
+} SharedPhotoFetch;
+
+typedef struct {
+  gchar *shared_id;
+  GDataEntry *entry;
+  GError *error;
+} SharedPhotoResult;
+
 static void
-query_gdata_documents (GomAccountMinerJob *job,
-                       TrackerSparqlConnection *connection,
-                       GHashTable *previous_resources,
-                       const gchar *datasource_urn,
-                       GDataDocumentsService *service,
-                       GCancellable *cancellable,
-                       GError **error)
+shared_photo_result_free (SharedPhotoResult *result)
 {
-  GDataDocumentsQuery *query = NULL;
-  GDataDocumentsFeed *feed = NULL;
-  GList *entries, *l;
-  gboolean succeeded_once = FALSE;
-
-  query = gdata_documents_query_new_with_limits (NULL, 1, MAX_RESULTS);
-  gdata_documents_query_set_show_folders (query, TRUE);
+  g_free (result->shared_id);
+  g_clear_object (&result->entry);
+  g_clear_error (&result->error);
+  g_slice_free (SharedPhotoResult, result);
+}
 
-  while (TRUE)
-    {
-      GError *local_error;
+static void
+shared_photo_fetch_thread_func (gpointer data,
+                                gpointer user_data)
+{
+  SharedPhotoFetch *fetch = user_data;
+  SharedPhotoResult *result;
+  GDataPicasaWebQuery *query;
 
-      local_error = NULL;
-      feed = gdata_documents_service_query_documents
-        (service, query,
-         cancellable, NULL, NULL, &local_error);
-      if (local_error != NULL)
-        {
-          if (succeeded_once)
-            {
-              g_warning ("Unable to query: %s", local_error->message);
-              g_error_free (local_error);
-            }
-          else
-            {
-              g_propagate_error (error, local_error);
-            }
+  result = g_slice_new0 (SharedPhotoResult);
+  result->shared_id = data;
 
-          break;
-        }
+  query = gdata_picasaweb_query_new (NULL);
+  gdata_picasaweb_query_set_image_size (query, "d");
+  result->entry = gdata_service_query_single_entry (GDATA_SERVICE (fetch->service),
+                                                    gdata_picasaweb_service_get_primary_authorization_domain (),
+                                                    result->shared_id,
+                                                    GDATA_QUERY (query),
+                                                    GDATA_TYPE_PICASAWEB_FILE,
+                                                    fetch->cancellable,
+                                                    &result->error);
+  g_object_unref (query);
 
-      succeeded_once = TRUE;
+  g_async_queue_push (fetch->results, result);
+}
 
-      entries = gdata_feed_get_entries (GDATA_FEED (feed));
-      if (entries == NULL)
+static void
+insert_shared_content_photos_batch (TrackerSparqlConnection *connection,
+                                    const gchar *datasource_urn,
+                                    const gchar **shared_ids,
+                                    const gchar *source_urn,
+                                    GDataPicasaWebService *service,
+                                    GCancellable *cancellable,
+                                    GError **error)
+{
+  GError *first_error = NULL;
+  GError *local_error;
+  GPtrArray *photo_resources;
+  GString *insert;
+  GThreadPool *pool;
+  SharedPhotoFetch fetch;
+  guint i;
+  guint n_pending = 0;
+
+  fetch.service = service;
+  fetch.cancellable = cancellable;
+  fetch.results = g_async_queue_new ();
+
+  /* The entries are fetched by a pool of threads, while this thread
+   * writes the photos to Tracker as they arrive. The links between the
+   * photos and the source are written at the end, in one update.
+   */
+  pool = g_thread_pool_new (shared_photo_fetch_thread_func, &fetch, SHARED_CONCURRENCY, FALSE, NULL);
+  for (i = 0; shared_ids[i] != NULL; i++)
+    {
+      g_thread_pool_push (pool, g_strdup (shared_ids[i]), NULL);
+      n_pending++;
+    }
+
+  photo_resources = g_ptr_array_new_with_free_func (g_free);
+
+  while (n_pending > 0)
+    {
+      SharedPhotoResult *result;
+      gchar *photo_resource_urn;
+
+      result = g_async_queue_pop (fetch.results);
+      n_pending--;
+
+      if (result->error != NULL)
+        {
+          g_warning ("Unable to query shared photo %s: %s", result->shared_id, result->error->message);
+          if (first_error == NULL)
+            first_error = g_error_copy (result->error);
+          goto next;
+        }
+
+      local_error = NULL;
+      photo_resource_urn = account_miner_job_process_photo (connection,
+                                                            NULL,
+                                                            datasource_urn,
+                                                            GDATA_PICASAWEB_FILE (result->entry),
+                                                            NULL,
+                                                            cancellable,
+                                                            &local_error);
+      if (local_error != NULL)
+        {
+          g_warning ("Unable to process shared photo %s: %s", result->shared_id, local_error->message);
+          if (first_error == NULL)
+            first_error = local_error;
+          else
+            g_error_free (local_error);
+          goto next;
+        }
+
+      g_ptr_array_add (photo_resources, photo_resource_urn);
+
+    next:
+      shared_photo_result_free (result);
+    }
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_async_queue_unref (fetch.results);
+
+  /* only fail if none of the photos could be inserted */
+  if (photo_resources->len == 0)
+    {
+      if (first_error != NULL)
+        {
+          g_propagate_error (error, first_error);
+          first_error = NULL;
+        }
+
+      goto out;
+    }
+
+  insert = g_string_new (NULL);
+  g_string_append_printf (insert,
+                          "INSERT OR REPLACE INTO <%s> { <%s> a nie:InformationElement ; nie:relatedTo ",
+                          datasource_urn, source_urn);
+
+  for (i = 0; i < photo_resources->len; i++)
+    g_string_append_printf (insert, "%s<%s>", (i > 0) ? ", " : "", (gchar *) photo_resources->pdata[i]);
+
+  g_string_append (insert, " . ");
+
+  for (i = 0; i < photo_resources->len; i++)
+    g_string_append_printf (insert,
+                            "<%s> a nie:InformationElement ; nie:links <%s> . ",
+                            (gchar *) photo_resources->pdata[i], source_urn);
+
+  g_string_append (insert, "}");
+
+  gom_tracker_sparql_connection_update (connection, insert->str, G_PRIORITY_DEFAULT, cancellable, error);
+  g_string_free (insert, TRUE);
+
+ out:
+  g_clear_error (&first_error);
+  g_ptr_array_unref (photo_resources);
+}
+
+static void
+insert_shared_content_batch (GomMiner *miner,
+                             gpointer service,
+                             TrackerSparqlConnection *connection,
+                             const gchar *datasource_urn,
+                             const gchar **shared_ids,
+                             const gchar *shared_type,
+                             const gchar *source_urn,
+                             GCancellable *cancellable,
+                             GError **error)
+{
+  if (g_strcmp0 (shared_type, "photos") == 0)
+    insert_shared_content_photos_batch (connection,
+                                        datasource_urn,
+                                        shared_ids,
+                                        source_urn,
+                                        GDATA_PICASAWEB_SERVICE (service),
+                                        cancellable,
+                                        error);
+}
+
+static void
+drive_message_cancelled_cb (GCancellable *cancellable, gpointer user_data)
+{
+  SoupMessage *msg = SOUP_MESSAGE (user_data);
+  SoupSession *session;
+
+  session = g_object_get_data (G_OBJECT (msg), DRIVE_SESSION_KEY);
+  soup_session_cancel_message (session, msg, SOUP_STATUS_CANCELLED);
+}
+
+/* like libgdata, abort the message when the cancellable is triggered
+ * instead of waiting for the reply
+ */
+static guint
+drive_send_message (SoupSession *session, SoupMessage *msg, GCancellable *cancellable)
+{
+  gulong cancel_id = 0;
+  guint status;
+
+  g_object_set_data (G_OBJECT (msg), DRIVE_SESSION_KEY, session);
+
+  if (cancellable != NULL)
+    cancel_id = g_cancellable_connect (cancellable, G_CALLBACK (drive_message_cancelled_cb), msg, NULL);
+
+  if (g_cancellable_is_cancelled (cancellable))
+    status = SOUP_STATUS_CANCELLED;
+  else
+    status = soup_session_send_message (session, msg);
+
+  if (cancel_id != 0)
+    g_cancellable_disconnect (cancellable, cancel_id);
+
+  return status;
+}
+
+static JsonNode *
+drive_request (GDataDocumentsService *service,
+               const gchar *uri,
+               GCancellable *cancellable,
+               GError **error)
+{
+  GDataAuthorizationDomain *authorization_domain;
+  GDataAuthorizer *authorizer;
+  JsonNode *retval = NULL;
+  JsonParser *parser = NULL;
+  SoupMessage *msg;
+  SoupSession *session;
+  guint status;
+
+  session = g_object_get_data (G_OBJECT (service), DRIVE_SESSION_KEY);
+  authorizer = gdata_service_get_authorizer (GDATA_SERVICE (service));
+  authorization_domain = gdata_documents_service_get_primary_authorization_domain ();
+
+  msg = soup_message_new (SOUP_METHOD_GET, uri);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  gdata_authorizer_process_request (authorizer, authorization_domain, msg);
+  status = drive_send_message (session, msg, cancellable);
+
+  /* the access token might just have expired */
+  if (status == SOUP_STATUS_UNAUTHORIZED)
+    {
+      if (!gdata_authorizer_refresh_authorization (authorizer, cancellable, error))
+        goto out;
+
+      g_object_unref (msg);
+      msg = soup_message_new (SOUP_METHOD_GET, uri);
+      gdata_authorizer_process_request (authorizer, authorization_domain, msg);
+      status = drive_send_message (session, msg, cancellable);
+    }
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (status))
+    {
+      g_set_error (error, g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Drive request failed: %u %s", status, msg->reason_phrase);
+      goto out;
+    }
+
+  parser = json_parser_new ();
+  if (!json_parser_load_from_data (parser, msg->response_body->data, msg->response_body->length, error))
+    goto out;
+
+  if (!JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+    {
+      g_set_error (error, g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Drive request failed: unexpected reply");
+      goto out;
+    }
+
+  retval = json_node_copy (json_parser_get_root (parser));
+
+ out:
+  g_clear_object (&parser);
+  g_object_unref (msg);
+  return retval;
+}
+
+static GType
+drive_file_get_entry_type (JsonObject *file)
+{
+  const gchar *mime_type = NULL;
+
+  if (json_object_has_member (file, "mimeType"))
+    mime_type = json_object_get_string_member (file, "mimeType");
+
+  if (g_strcmp0 (mime_type, "application/vnd.google-apps.folder") == 0)
+    return GDATA_TYPE_DOCUMENTS_FOLDER;
+  else if (g_strcmp0 (mime_type, "application/vnd.google-apps.document") == 0)
+    return GDATA_TYPE_DOCUMENTS_TEXT;
+  else if (g_strcmp0 (mime_type, "application/vnd.google-apps.drawing") == 0)
+    return GDATA_TYPE_DOCUMENTS_DRAWING;
+  else if (g_strcmp0 (mime_type, "application/vnd.google-apps.presentation") == 0)
+    return GDATA_TYPE_DOCUMENTS_PRESENTATION;
+  else if (g_strcmp0 (mime_type, "application/vnd.google-apps.spreadsheet") == 0)
+    return GDATA_TYPE_DOCUMENTS_SPREADSHEET;
+  else if (g_strcmp0 (mime_type, "application/pdf") == 0)
+    return GDATA_TYPE_DOCUMENTS_PDF;
+
+  return GDATA_TYPE_DOCUMENTS_DOCUMENT;
+}
+
+static gboolean
+drive_file_is_trashed (JsonObject *file)
+{
+  JsonObject *labels;
+
+  if (!json_object_has_member (file, "labels"))
+    return FALSE;
+
+  labels = json_object_get_object_member (file, "labels");
+  return json_object_has_member (labels, "trashed") && json_object_get_boolean_member (labels, "trashed");
+}
+
+static gboolean
+drive_delete_file (TrackerSparqlConnection *connection,
+                   const gchar *datasource_urn,
+                   AclEnrichment *acl,
+                   const gchar *file_id,
+                   GCancellable *cancellable,
+                   GError **error)
+{
+  gboolean retval = FALSE;
+  gchar *identifier;
+
+  /* a deleted file does not tell whether it was a folder, so try
+   * both kinds of identifiers
+   */
+  identifier = g_strdup_printf ("%s%s", PREFIX_DRIVE, file_id);
+  if (!gom_tracker_sparql_connection_delete_resource (connection, cancellable, error, datasource_urn, identifier))
+    goto out;
+
+  acl_enrichment_forget (acl, identifier);
+
+  g_free (identifier);
+  identifier = g_strdup_printf ("gd:collection:%s%s%s", PREFIX_DRIVE, DRIVE_FILES_URI, file_id);
+  if (!gom_tracker_sparql_connection_delete_resource (connection, cancellable, error, datasource_urn, identifier))
+    goto out;
+
+  acl_enrichment_forget (acl, identifier);
+
+  retval = TRUE;
+
+ out:
+  g_free (identifier);
+  return retval;
+}
+
+static gboolean
+previous_resources_is_drive (gpointer key,
+                             gpointer value,
+                             gpointer user_data)
+{
+  const gchar *identifier = key;
+
+  return g_str_has_prefix (identifier, PREFIX_DRIVE)
+    || g_str_has_prefix (identifier, "gd:collection:" PREFIX_DRIVE);
+}
+
+static gchar *
+query_gdata_documents_largest_change_id (GomAccountMinerJob *job,
+                                         GDataDocumentsService *service,
+                                         GCancellable *cancellable,
+                                         GError **error)
+{
+  JsonNode *root;
+  JsonObject *object;
+  gchar *retval = NULL;
+
+  root = drive_request (service, DRIVE_ABOUT_URI, cancellable, error);
+  g_atomic_int_inc (&job->n_requests);
+  if (root == NULL)
+    goto out;
+
+  object = json_node_get_object (root);
+  if (json_object_has_member (object, "largestChangeId"))
+    retval = g_strdup (json_object_get_string_member (object, "largestChangeId"));
+
+  json_node_free (root);
+
+ out:
+  return retval;
+}
+
+static gchar *
+query_gdata_documents_changes (GomAccountMinerJob *job,
+                               TrackerSparqlConnection *connection,
+                               GHashTable *previous_resources,
+                               const gchar *datasource_urn,
+                               GDataDocumentsService *service,
+                               GHashTable *folders,
+                               AclEnrichment *acl,
+                               const gchar *token,
+                               GCancellable *cancellable,
+                               GError **error)
+{
+  JsonGenerator *generator;
+  gboolean failed = FALSE;
+  gchar *largest_change_id = NULL;
+  gchar *page_token = NULL;
+  gint64 start_change_id;
+
+  start_change_id = g_ascii_strtoll (token, NULL, 10) + 1;
+  generator = json_generator_new ();
+
+  do
+    {
+      GError *local_error;
+      JsonArray *items;
+      JsonNode *root;
+      JsonObject *object;
+      gchar *uri;
+      guint i;
+
+      if (page_token != NULL)
+        {
+          gchar *escaped;
+
+          escaped = g_uri_escape_string (page_token, NULL, FALSE);
+          uri = g_strdup_printf ("%s?pageToken=%s&includeDeleted=true&maxResults=%u",
+                                 DRIVE_CHANGES_URI, escaped, MAX_CHANGES);
+          g_free (escaped);
+        }
+      else
+        {
+          uri = g_strdup_printf ("%s?startChangeId=%" G_GINT64_FORMAT "&includeDeleted=true&maxResults=%u",
+                                 DRIVE_CHANGES_URI, start_change_id, MAX_CHANGES);
+        }
+
+      g_clear_pointer (&page_token, g_free);
+
+      root = drive_request (service, uri, cancellable, error);
+      g_atomic_int_inc (&job->n_requests);
+      g_free (uri);
+
+      if (root == NULL)
+        goto out;
+
+      object = json_node_get_object (root);
+
+      if (json_object_has_member (object, "largestChangeId"))
+        {
+          g_free (largest_change_id);
+          largest_change_id = g_strdup (json_object_get_string_member (object, "largestChangeId"));
+        }
+
+      if (json_object_has_member (object, "nextPageToken"))
+        page_token = g_strdup (json_object_get_string_member (object, "nextPageToken"));
+
+      items = NULL;
+      if (json_object_has_member (object, "items"))
+        items = json_object_get_array_member (object, "items");
+
+      for (i = 0; items != NULL && i < json_array_get_length (items); i++)
+        {
+          GDataParsable *entry;
+          JsonObject *item;
+          JsonObject *file = NULL;
+          const gchar *file_id;
+          gchar *data;
+
+          item = json_array_get_object_element (items, i);
+          file_id = json_object_get_string_member (item, "fileId");
+
+          if (json_object_has_member (item, "file"))
+            file = json_object_get_object_member (item, "file");
+
+          local_error = NULL;
+
+          if ((json_object_has_member (item, "deleted") && json_object_get_boolean_member (item, "deleted"))
+              || file == NULL
+              || drive_file_is_trashed (file))
+            {
+              drive_delete_file (connection, datasource_urn, acl, file_id, cancellable, &local_error);
+              if (local_error != NULL)
+                {
+                  g_propagate_error (error, local_error);
+                  json_node_free (root);
+                  goto out;
+                }
+
+              continue;
+            }
+
+          json_generator_set_root (generator, json_object_get_member (item, "file"));
+          data = json_generator_to_data (generator, NULL);
+          entry = gdata_parsable_new_from_json (drive_file_get_entry_type (file), data, -1, &local_error);
+          g_free (data);
+
+          if (entry != NULL)
+            {
+              account_miner_job_process_entry (connection,
+                                               NULL,
+                                               datasource_urn,
+                                               folders,
+                                               acl,
+                                               GDATA_DOCUMENTS_ENTRY (entry),
+                                               cancellable,
+                                               &local_error);
+              g_object_unref (entry);
+            }
+
+          if (local_error != NULL)
+            {
+              g_warning ("Unable to process change for %s: %s", file_id, local_error->message);
+              g_error_free (local_error);
+              failed = TRUE;
+            }
+        }
+
+      json_node_free (root);
+    }
+  while (page_token != NULL);
+
+  /* everything that was not reported as changed is still there */
+  g_hash_table_foreach_remove (previous_resources, previous_resources_is_drive, NULL);
+
+  /* the same changes are asked for again the next time */
+  if (failed)
+    {
+      g_free (largest_change_id);
+      largest_change_id = g_strdup (token);
+    }
+
+ out:
+  g_free (page_token);
+  g_object_unref (generator);
+
+  if (*error != NULL)
+    g_clear_pointer (&largest_change_id, g_free);
+
+  return largest_change_id;
+}
+
+typedef struct {
+  GomAccountMinerJob *job;
+  GDataDocumentsService *service;
+  GDataDocumentsQuery *query;
+  gint min_page_size;
+  gint max_page_size;
+  gint page_size;
+  GCancellable *cancellable;
+  GAsyncQueue *pages;
+  GAsyncQueue *slots;
+  volatile gint stop;
+} PrefetchData;
+
+typedef struct {
+  GDataDocumentsFeed *feed;
+  GError *error;
+} PrefetchPage;
+
+static void
+prefetch_page_free (PrefetchPage *page)
+{
+  g_clear_object (&page->feed);
+  g_clear_error (&page->error);
+  g_slice_free (PrefetchPage, page);
+}
+
+static gpointer
+prefetch_thread_func (gpointer user_data)
+{
+  PrefetchData *data = user_data;
+
+  while (TRUE)
+    {
+      PrefetchPage *page;
+      gboolean last;
+      gint64 elapsed;
+      gint64 start;
+
+      /* wait until the consumer is not too far behind */
+      g_async_queue_pop (data->slots);
+      if (g_atomic_int_get (&data->stop))
         break;
 
+      page = g_slice_new0 (PrefetchPage);
+
+      gdata_query_set_max_results (GDATA_QUERY (data->query), data->page_size);
+      start = g_get_monotonic_time ();
+      page->feed = gdata_documents_service_query_documents
+        (data->service, data->query,
+         data->cancellable, NULL, NULL, &page->error);
+      elapsed = g_get_monotonic_time () - start;
+
+      g_atomic_int_inc (&data->job->n_requests);
+
+      last = (page->error != NULL || gdata_feed_get_entries (GDATA_FEED (page->feed)) == NULL);
+      if (!last)
+        {
+          guint n_entries;
+
+          /* Fewer, bigger pages save a TLS and authorization round
+           * trip each, but a page that takes too long is more likely
+           * to time out and delays the writer.
+           */
+          n_entries = g_list_length (gdata_feed_get_entries (GDATA_FEED (page->feed)));
+          if (elapsed < TARGET_PAGE_TIME / 2 && n_entries >= (guint) data->page_size)
+            data->page_size = MIN (data->page_size * 2, data->max_page_size);
+          else if (elapsed > TARGET_PAGE_TIME)
+            data->page_size = MAX (data->page_size / 2, data->min_page_size);
+
+          gdata_query_next_page (GDATA_QUERY (data->query));
+        }
+
+      g_async_queue_push (data->pages, page);
+
+      if (last)
+        break;
+    }
+
+  return NULL;
+}
+
+/* returns whether all the documents were listed */
+static gboolean
+query_gdata_documents_all (GomAccountMinerJob *job,
+                           TrackerSparqlConnection *connection,
+                           GHashTable *previous_resources,
+                           const gchar *datasource_urn,
+                           GDataDocumentsService *service,
+                           GHashTable *folders,
+                           AclEnrichment *acl,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+  GThread *thread;
+  PrefetchData data;
+  GList *entries, *l;
+  gboolean complete = FALSE;
+  gboolean succeeded_once = FALSE;
+  guint i;
+
+  data.job = job;
+  data.service = service;
+  data.min_page_size = gom_account_miner_job_get_config_int (job, "min-page-size", MAX_RESULTS);
+  data.min_page_size = CLAMP (data.min_page_size, 1, MAX_PAGE_SIZE);
+  data.max_page_size = gom_account_miner_job_get_config_int (job, "max-page-size", MAX_PAGE_SIZE);
+  data.max_page_size = CLAMP (data.max_page_size, data.min_page_size, MAX_PAGE_SIZE);
+  data.page_size = data.min_page_size;
+  data.query = gdata_documents_query_new_with_limits (NULL, 1, data.page_size);
+  data.cancellable = cancellable;
+  data.pages = g_async_queue_new_full ((GDestroyNotify) prefetch_page_free);
+  data.slots = g_async_queue_new ();
+  data.stop = FALSE;
+
+  gdata_documents_query_set_show_folders (data.query, TRUE);
+
+  /* The next pages are fetched by a helper thread while the current
+   * one is being written to Tracker, but never more than
+   * PREFETCH_PAGES ahead.
+   */
+  for (i = 0; i < PREFETCH_PAGES; i++)
+    g_async_queue_push (data.slots, GUINT_TO_POINTER (1));
+
+  thread = g_thread_new ("gom-gdata-prefetch", prefetch_thread_func, &data);
+
+  while (TRUE)
+    {
+      GError *local_error;
+      PrefetchPage *page;
+
+      page = g_async_queue_pop (data.pages);
+
+      if (page->error != NULL)
+        {
+          if (succeeded_once)
+            {
+              g_warning ("Unable to query: %s", page->error->message);
+            }
+          else
+            {
+              g_propagate_error (error, page->error);
+              page->error = NULL;
+            }
+
+          prefetch_page_free (page);
+          break;
+        }
+
+      succeeded_once = TRUE;
+
+      entries = gdata_feed_get_entries (GDATA_FEED (page->feed));
+      if (entries == NULL)
+        {
+          prefetch_page_free (page);
+          complete = TRUE;
+          break;
+        }
+
+      g_atomic_int_add (&job->n_entries, g_list_length (entries));
+
       for (l = entries; l != NULL; l = l->next)
         {
           local_error = NULL;
           account_miner_job_process_entry (connection,
                                            previous_resources,
                                            datasource_urn,
-                                           service,
+                                           folders,
+                                           acl,
                                            l->data,
                                            cancellable,
                                            &local_error);
@@ -978,13 +1921,288 @@ query_gdata_documents (GomAccountMinerJob *job,
             }
         }
 
-      gdata_query_next_page (GDATA_QUERY (query));
-      g_clear_object (&feed);
+      prefetch_page_free (page);
+      g_async_queue_push (data.slots, GUINT_TO_POINTER (1));
+    }
+
+  /* the helper might be waiting for a slot */
+  g_atomic_int_set (&data.stop, TRUE);
+  g_async_queue_push (data.slots, GUINT_TO_POINTER (1));
+  g_thread_join (thread);
+
+  g_debug ("Account %s: Drive page size ended at %d",
+           goa_account_get_id (job->account),
+           data.page_size);
+
+  g_async_queue_unref (data.pages);
+  g_async_queue_unref (data.slots);
+  g_object_unref (data.query);
+
+  return complete;
+}
+
+static void
+query_gdata_documents (GomAccountMinerJob *job,
+                       TrackerSparqlConnection *connection,
+                       GHashTable *previous_resources,
+                       const gchar *datasource_urn,
+                       GDataDocumentsService *service,
+                       GCancellable *cancellable,
+                       GError **error)
+{
+  AclEnrichment *acl;
+  GError *local_error = NULL;
+  GHashTable *folders;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  gboolean complete = FALSE;
+  gchar *largest_change_id = NULL;
+  gchar *token;
+
+  acl = acl_enrichment_new (job, connection, datasource_urn, service, cancellable);
+
+  /* folder identifier -> URN, starting with the folders we already know */
+  folders = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_iter_init (&iter, previous_resources);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (g_str_has_prefix (key, "gd:collection:" PREFIX_DRIVE))
+        g_hash_table_insert (folders, g_strdup (key), g_strdup (value));
+    }
+
+  token = gom_account_miner_job_dup_sync_token (job, "documents", &local_error);
+  if (local_error != NULL)
+    {
+      g_warning ("Unable to read the Drive change token: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  /* Only ask for what changed since the last refresh. If the token is
+   * not accepted anymore, fall back to listing everything.
+   */
+  if (token != NULL)
+    {
+      largest_change_id = query_gdata_documents_changes (job,
+                                                         connection,
+                                                         previous_resources,
+                                                         datasource_urn,
+                                                         service,
+                                                         folders,
+                                                         acl,
+                                                         token,
+                                                         cancellable,
+                                                         &local_error);
+      if (largest_change_id != NULL)
+        goto out;
+
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_propagate_error (error, local_error);
+          goto out;
+        }
+
+      g_debug ("Unable to fetch the Drive changes, listing everything: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  /* Ask for the change ID before listing, so that the changes made
+   * while listing are picked up by the next refresh.
+   */
+  largest_change_id = query_gdata_documents_largest_change_id (job, service, cancellable, &local_error);
+  if (local_error != NULL)
+    {
+      g_debug ("Unable to fetch the Drive change ID: %s", local_error->message);
+      g_clear_error (&local_error);
     }
 
+  complete = query_gdata_documents_all (job,
+                                        connection,
+                                        previous_resources,
+                                        datasource_urn,
+                                        service,
+                                        folders,
+                                        acl,
+                                        cancellable,
+                                        error);
+  if (*error != NULL)
+    g_clear_pointer (&largest_change_id, g_free);
+
  out:
-  g_clear_object (&feed);
-  g_clear_object (&query);
+  /* without a change ID, the next refresh lists everything again */
+  if (*error == NULL)
+    {
+      gom_account_miner_job_set_sync_token (job, "documents", largest_change_id, &local_error);
+      if (local_error != NULL)
+        {
+          g_warning ("Unable to store the Drive change token: %s", local_error->message);
+          g_error_free (local_error);
+        }
+    }
+
+  /* whatever made it into Tracker can still be enriched */
+  acl_enrichment_run (acl, complete);
+  acl_enrichment_free (acl);
+
+  g_hash_table_unref (folders);
+
+  g_free (largest_change_id);
+  g_free (token);
+}
+
+typedef struct {
+  GDataPicasaWebService *service;
+  GCancellable *cancellable;
+  GAsyncQueue *results;
+  GAsyncQueue *slots;
+} AlbumFetch;
+
+typedef struct {
+  GDataPicasaWebAlbum *album;
+  GDataFeed *feed;
+  GError *error;
+  gboolean last;
+} AlbumResult;
+
+static void
+album_result_free (AlbumResult *result)
+{
+  g_object_unref (result->album);
+  g_clear_object (&result->feed);
+  g_clear_error (&result->error);
+  g_slice_free (AlbumResult, result);
+}
+
+static void
+album_fetch_thread_func (gpointer data,
+                         gpointer user_data)
+{
+  AlbumFetch *fetch = user_data;
+  GDataPicasaWebAlbum *album = GDATA_PICASAWEB_ALBUM (data);
+  guint start_index = 1;
+
+  /* Big albums are listed one page at a time, and each page is handed
+   * to the writer as soon as it arrives. The slots keep the pages
+   * that are waiting to be written from piling up.
+   */
+  while (TRUE)
+    {
+      AlbumResult *result;
+      GDataPicasaWebQuery *query;
+      guint n_entries = 0;
+
+      g_async_queue_pop (fetch->slots);
+
+      result = g_slice_new0 (AlbumResult);
+      result->album = g_object_ref (album);
+
+      query = gdata_picasaweb_query_new_with_limits (NULL, start_index, ALBUM_PAGE_SIZE);
+      gdata_picasaweb_query_set_image_size (query, "d");
+      result->feed = gdata_picasaweb_service_query_files (fetch->service, album, GDATA_QUERY (query),
+                                                          fetch->cancellable, NULL, NULL, &result->error);
+      g_object_unref (query);
+
+      if (result->feed != NULL)
+        n_entries = g_list_length (gdata_feed_get_entries (result->feed));
+
+      result->last = (result->error != NULL || n_entries < ALBUM_PAGE_SIZE);
+      g_async_queue_push (fetch->results, result);
+
+      if (result->last)
+        break;
+
+      start_index += n_entries;
+    }
+
+  g_object_unref (album);
+}
+
+static void
+account_miner_job_process_album_photos (TrackerSparqlConnection *connection,
+                                        GHashTable *previous_resources,
+                                        const gchar *datasource_urn,
+                                        GDataFeed *feed,
+                                        const gchar *album_resource,
+                                        GCancellable *cancellable)
+{
+  GList *l;
+
+  for (l = gdata_feed_get_entries (feed); l != NULL; l = l->next)
+    {
+      GDataPicasaWebFile *file = GDATA_PICASAWEB_FILE (l->data);
+      GError *local_error = NULL;
+      gchar *photo_resource_urn;
+
+      photo_resource_urn = account_miner_job_process_photo (connection,
+                                                            previous_resources,
+                                                            datasource_urn,
+                                                            file,
+                                                            album_resource,
+                                                            cancellable,
+                                                            &local_error);
+
+      if (local_error != NULL)
+        {
+          const gchar *photo_id;
+
+          photo_id = gdata_picasaweb_file_get_id (file);
+          g_warning ("Unable to process photo %s: %s", photo_id, local_error->message);
+          g_error_free (local_error);
+        }
+
+      g_free (photo_resource_urn);
+    }
+}
+
+static gboolean
+account_miner_job_mark_album_photos_seen (TrackerSparqlConnection *connection,
+                                          GHashTable *previous_resources,
+                                          const gchar *datasource_urn,
+                                          GDataPicasaWebAlbum *album,
+                                          const gchar *album_resource,
+                                          GCancellable *cancellable,
+                                          GError **error)
+{
+  GPtrArray *identifiers;
+  GString *select;
+  TrackerSparqlCursor *cursor;
+  gboolean retval = FALSE;
+  guint i;
+
+  select = g_string_new (NULL);
+  g_string_append_printf (select,
+                          "SELECT ?id WHERE { ?urn nie:isPartOf <%s> ; nie:dataSource <%s> ; nao:identifier ?id }",
+                          album_resource, datasource_urn);
+
+  cursor = tracker_sparql_connection_query (connection, select->str, cancellable, error);
+  g_string_free (select, TRUE);
+
+  if (cursor == NULL)
+    return FALSE;
+
+  identifiers = g_ptr_array_new_with_free_func (g_free);
+  while (tracker_sparql_cursor_next (cursor, cancellable, error))
+    g_ptr_array_add (identifiers, g_strdup (tracker_sparql_cursor_get_string (cursor, 0, NULL)));
+
+  g_object_unref (cursor);
+
+  if (*error != NULL)
+    goto out;
+
+  /* photos might have been added or removed without touching the
+   * album's timestamp
+   */
+  if (identifiers->len != gdata_picasaweb_album_get_num_photos (album))
+    goto out;
+
+  for (i = 0; i < identifiers->len; i++)
+    g_hash_table_remove (previous_resources, g_ptr_array_index (identifiers, i));
+
+  retval = TRUE;
+
+ out:
+  g_ptr_array_unref (identifiers);
+  return retval;
 }
 
 static void
@@ -996,26 +2214,56 @@ query_gdata_photos (GomAccountMinerJob *job,
                     GCancellable *cancellable,
                     GError **error)
 {
+  AlbumFetch fetch;
   GDataFeed *feed;
+  GHashTable *album_resources;
   GList *albums, *l;
+  GThreadPool *pool;
+  guint n_pending = 0;
+  gint max_threads;
+  guint i;
 
   feed = gdata_picasaweb_service_query_all_albums (service, NULL, NULL, cancellable, NULL, NULL, error);
+  g_atomic_int_inc (&job->n_requests);
 
   if (feed == NULL)
     return;
 
+  fetch.service = service;
+  fetch.cancellable = cancellable;
+  fetch.results = g_async_queue_new ();
+  fetch.slots = g_async_queue_new ();
+
+  /* The photo feeds are fetched by a pool of threads, but only this
+   * thread writes to Tracker. Meanwhile, it takes care of the albums
+   * themselves, and only the ones that changed have their photo feed
+   * fetched at all.
+   */
+  max_threads = gom_account_miner_job_get_config_int (job, "album-concurrency", ALBUM_CONCURRENCY);
+  max_threads = MAX (max_threads, 1);
+  pool = g_thread_pool_new (album_fetch_thread_func, &fetch, max_threads, FALSE, NULL);
+
+  for (i = 0; i < (guint) max_threads * 2; i++)
+    g_async_queue_push (fetch.slots, GUINT_TO_POINTER (1));
+
+  album_resources = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
   albums = gdata_feed_get_entries (feed);
+  g_atomic_int_add (&job->n_entries, g_list_length (albums));
+
   for (l = albums; l != NULL; l = l->next)
     {
       GDataPicasaWebAlbum *album = GDATA_PICASAWEB_ALBUM (l->data);
+      gboolean changed = TRUE;
+      gchar *resource;
 
-      account_miner_job_process_album (connection,
-                                       previous_resources,
-                                       datasource_urn,
-                                       service,
-                                       album,
-                                       cancellable,
-                                       error);
+      resource = account_miner_job_process_album (connection,
+                                                  previous_resources,
+                                                  datasource_urn,
+                                                  album,
+                                                  &changed,
+                                                  cancellable,
+                                                  error);
 
       if (*error != NULL)
         {
@@ -1024,12 +2272,133 @@ query_gdata_photos (GomAccountMinerJob *job,
           album_id = gdata_picasaweb_album_get_id (album);
           g_warning ("Unable to process album %s: %s", album_id, (*error)->message);
           g_clear_error (error);
+          continue;
+        }
+
+      g_hash_table_insert (album_resources, album, resource);
+
+      /* an unchanged album still has the photos that we know about */
+      if (!changed)
+        {
+          GError *local_error = NULL;
+
+          if (account_miner_job_mark_album_photos_seen (connection,
+                                                        previous_resources,
+                                                        datasource_urn,
+                                                        album,
+                                                        resource,
+                                                        cancellable,
+                                                        &local_error))
+            continue;
+
+          if (local_error != NULL)
+            {
+              g_warning ("Unable to query the photos of album %s: %s",
+                         gdata_picasaweb_album_get_id (album),
+                         local_error->message);
+              g_error_free (local_error);
+            }
         }
+
+      g_thread_pool_push (pool, g_object_ref (album), NULL);
+      n_pending++;
     }
 
+  while (n_pending > 0)
+    {
+      AlbumResult *result;
+      const gchar *album_resource;
+
+      result = g_async_queue_pop (fetch.results);
+      g_atomic_int_inc (&job->n_requests);
+
+      if (result->last)
+        n_pending--;
+
+      /* an album that could not be written is not refreshed at all */
+      album_resource = g_hash_table_lookup (album_resources, result->album);
+      if (album_resource == NULL)
+        goto next;
+
+      if (result->error != NULL)
+        {
+          g_warning ("Unable to query album %s: %s",
+                     gdata_picasaweb_album_get_id (result->album),
+                     result->error->message);
+          goto next;
+        }
+
+      g_atomic_int_add (&job->n_entries, g_list_length (gdata_feed_get_entries (result->feed)));
+      account_miner_job_process_album_photos (connection,
+                                              previous_resources,
+                                              datasource_urn,
+                                              result->feed,
+                                              album_resource,
+                                              cancellable);
+
+    next:
+      album_result_free (result);
+      g_async_queue_push (fetch.slots, GUINT_TO_POINTER (1));
+    }
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_async_queue_unref (fetch.results);
+  g_async_queue_unref (fetch.slots);
+  g_hash_table_unref (album_resources);
   g_object_unref (feed);
 }
 
+typedef struct {
+  GomAccountMinerJob *job;
+  TrackerSparqlConnection *connection;
+  GHashTable *previous_resources;
+  const gchar *datasource_urn;
+  GDataPicasaWebService *service;
+  GCancellable *cancellable;
+  GError *error;
+} PhotosCrawl;
+
+static gpointer
+photos_crawl_thread_func (gpointer user_data)
+{
+  PhotosCrawl *crawl = user_data;
+
+  gom_tracker_set_update_counter (&crawl->job->n_updates);
+
+  query_gdata_photos (crawl->job,
+                      crawl->connection,
+                      crawl->previous_resources,
+                      crawl->datasource_urn,
+                      crawl->service,
+                      crawl->cancellable,
+                      &crawl->error);
+
+  gom_tracker_set_update_counter (NULL);
+  return NULL;
+}
+
+static void
+previous_resources_move (GHashTable *from,
+                         GHashTable *to,
+                         gboolean photos_only)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, from);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (photos_only
+          && !g_str_has_prefix (key, PREFIX_PICASAWEB)
+          && !g_str_has_prefix (key, "photos:collection:" PREFIX_PICASAWEB))
+        continue;
+
+      g_hash_table_iter_steal (&iter);
+      g_hash_table_insert (to, key, value);
+    }
+}
+
 static void
 query_gdata (GomAccountMinerJob *job,
              TrackerSparqlConnection *connection,
@@ -1038,27 +2407,84 @@ query_gdata (GomAccountMinerJob *job,
              GCancellable *cancellable,
              GError **error)
 {
-  gpointer service;
-
-  service = g_hash_table_lookup (job->services, "documents");
-  if (service != NULL)
-    query_gdata_documents (job,
-                           connection,
-                           previous_resources,
-                           datasource_urn,
-                           GDATA_DOCUMENTS_SERVICE (service),
-                           cancellable,
-                           error);
-
-  service = g_hash_table_lookup (job->services, "photos");
-  if (service != NULL)
-    query_gdata_photos (job,
-                        connection,
-                        previous_resources,
-                        datasource_urn,
-                        GDATA_PICASAWEB_SERVICE (service),
-                        cancellable,
-                        error);
+  GThread *thread;
+  PhotosCrawl crawl;
+  gpointer documents_service;
+  gpointer photos_service;
+
+  documents_service = g_hash_table_lookup (job->services, "documents");
+  photos_service = g_hash_table_lookup (job->services, "photos");
+
+  if (documents_service == NULL || photos_service == NULL)
+    {
+      if (documents_service != NULL)
+        query_gdata_documents (job,
+                               connection,
+                               previous_resources,
+                               datasource_urn,
+                               GDATA_DOCUMENTS_SERVICE (documents_service),
+                               cancellable,
+                               error);
+
+      if (photos_service != NULL)
+        query_gdata_photos (job,
+                            connection,
+                            previous_resources,
+                            datasource_urn,
+                            GDATA_PICASAWEB_SERVICE (photos_service),
+                            cancellable,
+                            error);
+
+      return;
+    }
+
+  /* The two services have nothing in common but the Tracker
+   * connection, so crawl them at the same time. Each crawl gets its
+   * own share of the previous resources, which are put back together
+   * for the cleanup once both are done.
+   */
+  crawl.job = job;
+  crawl.connection = connection;
+  crawl.previous_resources = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  crawl.datasource_urn = datasource_urn;
+  crawl.service = GDATA_PICASAWEB_SERVICE (photos_service);
+  crawl.cancellable = cancellable;
+  crawl.error = NULL;
+
+  previous_resources_move (previous_resources, crawl.previous_resources, TRUE);
+
+  thread = g_thread_new ("gom-gdata-photos", photos_crawl_thread_func, &crawl);
+
+  query_gdata_documents (job,
+                         connection,
+                         previous_resources,
+                         datasource_urn,
+                         GDATA_DOCUMENTS_SERVICE (documents_service),
+                         cancellable,
+                         error);
+
+  g_thread_join (thread);
+
+  previous_resources_move (crawl.previous_resources, previous_resources, FALSE);
+  g_hash_table_unref (crawl.previous_resources);
+
+  if (crawl.error != NULL)
+    {
+      if (*error == NULL)
+        g_propagate_error (error, crawl.error);
+      else
+        g_error_free (crawl.error);
+    }
+}
+
+static GDataDocumentsService *
+documents_service_new (GDataAuthorizer *authorizer)
+{
+  GDataDocumentsService *service;
+
+  service = gdata_documents_service_new (authorizer);
+  g_object_set_data_full (G_OBJECT (service), DRIVE_SESSION_KEY, soup_session_new (), g_object_unref);
+  return service;
 }
 
 static gpointer
@@ -1070,7 +2496,7 @@ create_service (GomMiner *miner, GoaObject *object, const gchar *type)
   authorizer = gdata_goa_authorizer_new (object);
 
   if (g_strcmp0 (type, "documents") == 0)
-    service = gdata_documents_service_new (GDATA_AUTHORIZER (authorizer));
+    service = documents_service_new (GDATA_AUTHORIZER (authorizer));
 
   if (g_strcmp0 (type, "photos") == 0)
     service = gdata_picasaweb_service_new (GDATA_AUTHORIZER (authorizer));
@@ -1081,7 +2507,8 @@ create_service (GomMiner *miner, GoaObject *object, const gchar *type)
 
 static GHashTable *
 create_services (GomMiner *self,
-                 GoaObject *object)
+                 GoaObject *object,
+                 const gchar **index_types)
 {
   GDataGoaAuthorizer *authorizer;
   GHashTable *services;
@@ -1091,15 +2518,15 @@ create_services (GomMiner *self,
 
   authorizer = gdata_goa_authorizer_new (object);
 
-  if (gom_miner_supports_type (self, "documents") && goa_object_peek_files (object) != NULL)
+  if (gom_miner_supports_type (index_types, "documents") && goa_object_peek_files (object) != NULL)
     {
       GDataDocumentsService *service;
 
-      service = gdata_documents_service_new (GDATA_AUTHORIZER (authorizer));
+      service = documents_service_new (GDATA_AUTHORIZER (authorizer));
       g_hash_table_insert (services, "documents", service);
     }
 
-  if (gom_miner_supports_type (self, "photos") && goa_object_peek_photos (object) != NULL)
+  if (gom_miner_supports_type (index_types, "photos") && goa_object_peek_photos (object) != NULL)
     {
       GDataPicasaWebService *service;
 
@@ -1136,5 +2563,6 @@ gom_gdata_miner_class_init (GomGDataMinerClass *klass)
   miner_class->create_services = create_services;
   miner_class->destroy_service = destroy_service;
   miner_class->insert_shared_content = insert_shared_content;
+  miner_class->insert_shared_content_batch = insert_shared_content_batch;
   miner_class->query = query_gdata;
 }
@@ -177,14 +177,15 @@ query_media_server (GomAccountMinerJob *job,
 
 static GHashTable *
 create_services (GomMiner *self,
-                 GoaObject *object)
+                 GoaObject *object,
+                 const gchar **index_types)
 {
   GHashTable *services;
 
   services = g_hash_table_new_full (g_str_hash, g_str_equal,
                                     NULL, (GDestroyNotify) g_object_unref);
 
-  if (gom_miner_supports_type (self, "photos"))
+  if (gom_miner_supports_type (index_types, "photos"))
     g_hash_table_insert (services, "photos", g_object_ref (object));
 
   return services;
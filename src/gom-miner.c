@@ -25,20 +25,27 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 
 #include "gom-miner.h"
 
-static void gom_miner_initable_iface_init (GInitableIface *iface);
+#define DEFAULT_MIN_REFRESH_INTERVAL 300 /* seconds */
+
+static void gom_miner_async_initable_iface_init (GAsyncInitableIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (GomMiner, gom_miner, G_TYPE_OBJECT,
-                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, gom_miner_initable_iface_init))
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, gom_miner_async_initable_iface_init))
 
 struct _GomMinerPrivate {
   GoaClient *client;
   TrackerSparqlConnection *connection;
   gboolean is_initialized;
   gchar *display_name;
-  gchar **index_types;
+
+  /* account ID -> (index types -> services) */
+  GHashTable *services;
 };
 
 typedef struct {
@@ -47,12 +54,20 @@ typedef struct {
   GList *acc_objects;
   GList *old_datasources;
   GList *pending_jobs;
+  gchar **index_types;
+  GKeyFile *config;
+  gboolean force;
 } CleanupJob;
 
+typedef struct {
+  GError *error;
+  guint pending;
+} InitData;
+
 typedef struct {
   GomMiner *self;
   gchar *account_id;
-  gchar *shared_id;
+  gchar **shared_ids;
   gchar *shared_type;
   gchar *source_urn;
   gpointer service;
@@ -60,7 +75,11 @@ typedef struct {
 
 static GThreadPool *cleanup_pool;
 
+/* shared by all the miners that live in the same process */
+static GoaClient *shared_client;
+
 static void cleanup_job (gpointer data, gpointer user_data);
+static void gom_account_miner_job_load_path_rules (GomAccountMinerJob *job);
 
 static void
 gom_account_miner_job_free (GomAccountMinerJob *job)
@@ -74,6 +93,13 @@ gom_account_miner_job_free (GomAccountMinerJob *job)
 
   g_free (job->datasource_urn);
   g_free (job->root_element_urn);
+  g_strfreev (job->index_types);
+  g_key_file_unref (job->config);
+
+  g_ptr_array_unref (job->include_patterns);
+  g_ptr_array_unref (job->include_paths);
+  g_ptr_array_unref (job->exclude_patterns);
+  g_free (job->path_rules_checksum);
 
   g_hash_table_unref (job->previous_resources);
 
@@ -87,7 +113,7 @@ gom_insert_shared_content_data_free (InsertSharedContentData *data)
 
   g_object_unref (data->self);
   g_free (data->account_id);
-  g_free (data->shared_id);
+  g_strfreev (data->shared_ids);
   g_free (data->shared_type);
   g_free (data->source_urn);
 
@@ -97,7 +123,7 @@ gom_insert_shared_content_data_free (InsertSharedContentData *data)
 static InsertSharedContentData *
 gom_insert_shared_content_data_new (GomMiner *self,
                                     const gchar *account_id,
-                                    const gchar *shared_id,
+                                    const gchar **shared_ids,
                                     const gchar *shared_type,
                                     const gchar *source_urn,
                                     gpointer service)
@@ -107,7 +133,7 @@ gom_insert_shared_content_data_new (GomMiner *self,
   retval = g_slice_new0 (InsertSharedContentData);
   retval->self = g_object_ref (self);
   retval->account_id = g_strdup (account_id);
-  retval->shared_id = g_strdup (shared_id);
+  retval->shared_ids = g_strdupv ((gchar **) shared_ids);
   retval->shared_type = g_strdup (shared_type);
   retval->source_urn = g_strdup (source_urn);
   retval->service = service;
@@ -123,14 +149,33 @@ gom_miner_dispose (GObject *object)
   g_clear_object (&self->priv->client);
   g_clear_object (&self->priv->connection);
 
+  g_clear_pointer (&self->priv->services, g_hash_table_unref);
+
   g_free (self->priv->display_name);
-  g_strfreev (self->priv->index_types);
 
   G_OBJECT_CLASS (gom_miner_parent_class)->dispose (object);
 }
 
 static void
-gom_miner_init_goa (GomMiner *self, GError **error)
+gom_miner_account_changed_cb (GoaClient *client,
+                              GoaObject *object,
+                              gpointer user_data)
+{
+  GomMiner *self = GOM_MINER (user_data);
+  GoaAccount *account;
+
+  account = goa_object_peek_account (object);
+  if (account == NULL)
+    return;
+
+  /* the credentials, the enabled features or the account itself might
+   * have gone away, so the cached services can not be trusted anymore
+   */
+  g_hash_table_remove (self->priv->services, goa_account_get_id (account));
+}
+
+static void
+gom_miner_setup_goa (GomMiner *self)
 {
   GoaAccount *account;
   GoaObject *object;
@@ -138,10 +183,16 @@ gom_miner_init_goa (GomMiner *self, GError **error)
   GList *accounts, *l;
   GomMinerClass *miner_class = GOM_MINER_GET_CLASS (self);
 
-  self->priv->client = goa_client_new_sync (NULL, error);
-
-  if (self->priv->client == NULL)
-    return;
+  g_signal_connect_object (self->priv->client,
+                           "account-changed",
+                           G_CALLBACK (gom_miner_account_changed_cb),
+                           self,
+                           0);
+  g_signal_connect_object (self->priv->client,
+                           "account-removed",
+                           G_CALLBACK (gom_miner_account_changed_cb),
+                           self,
+                           0);
 
   accounts = goa_client_get_accounts (self->priv->client);
   for (l = accounts; l != NULL; l = l->next)
@@ -162,6 +213,9 @@ gom_miner_init_goa (GomMiner *self, GError **error)
     }
 
   g_list_free_full (accounts, g_object_unref);
+
+  if (miner_class->setup != NULL)
+    miner_class->setup (self, self->priv->client);
 }
 
 static void
@@ -171,6 +225,8 @@ gom_miner_init (GomMiner *self)
 
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GOM_TYPE_MINER, GomMinerPrivate);
   self->priv->display_name = g_strdup ("");
+  self->priv->services = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify) g_hash_table_unref);
 }
 
 static void
@@ -185,39 +241,166 @@ gom_miner_class_init (GomMinerClass *klass)
   g_type_class_add_private (klass, sizeof (GomMinerPrivate));
 }
 
-static gboolean
-gom_miner_initable_init (GInitable *initable, GCancellable *cancellable, GError **error)
+static void
+init_data_free (InitData *data)
 {
-  GomMiner *self = GOM_MINER (initable);
-  gboolean ret_val = FALSE;
+  g_clear_error (&data->error);
+  g_slice_free (InitData, data);
+}
 
-  g_return_val_if_fail (!self->priv->is_initialized, FALSE);
+static void
+gom_miner_init_complete (GTask *task)
+{
+  GomMiner *self;
+  InitData *data;
 
-  self->priv->connection = tracker_sparql_connection_get (cancellable, error);
-  if (G_UNLIKELY (self->priv->connection == NULL))
+  data = g_task_get_task_data (task);
+  data->pending--;
+  if (data->pending > 0)
+    goto out;
+
+  self = GOM_MINER (g_task_get_source_object (task));
+  self->priv->is_initialized = TRUE;
+
+  if (data->error != NULL)
     {
-      g_prefix_error (error, "Unable to connect to Tracker store: ");
+      g_task_return_error (task, data->error);
+      data->error = NULL;
       goto out;
     }
 
-  gom_miner_init_goa (self, error);
-  if (G_UNLIKELY (self->priv->client == NULL))
+  gom_miner_setup_goa (self);
+  g_task_return_boolean (task, TRUE);
+
+ out:
+  g_object_unref (task);
+}
+
+static void
+gom_miner_init_take_error (GTask *task, GError *error)
+{
+  InitData *data;
+
+  data = g_task_get_task_data (task);
+
+  /* only the first failure is reported */
+  if (data->error == NULL)
+    data->error = error;
+  else
+    g_error_free (error);
+}
+
+static void
+gom_miner_init_goa_cb (GObject *source,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GomMiner *self;
+  GoaClient *client;
+  GError *error = NULL;
+
+  self = GOM_MINER (g_task_get_source_object (task));
+
+  client = goa_client_new_finish (res, &error);
+  if (G_UNLIKELY (client == NULL))
     {
-      g_prefix_error (error, "Unable to connect to GNOME Online Accounts: ");
+      g_prefix_error (&error, "Unable to connect to GNOME Online Accounts: ");
+      gom_miner_init_take_error (task, error);
       goto out;
     }
 
-  ret_val = TRUE;
+  /* another miner in this process might have got there first */
+  if (shared_client != NULL)
+    {
+      self->priv->client = g_object_ref (shared_client);
+      g_object_unref (client);
+    }
+  else
+    {
+      self->priv->client = client;
+      shared_client = client;
+      g_object_add_weak_pointer (G_OBJECT (shared_client), (gpointer *) &shared_client);
+    }
 
  out:
-  self->priv->is_initialized = TRUE;
-  return ret_val;
+  gom_miner_init_complete (task);
+}
+
+static void
+gom_miner_init_tracker_cb (GObject *source,
+                           GAsyncResult *res,
+                           gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GomMiner *self;
+  GError *error = NULL;
+
+  self = GOM_MINER (g_task_get_source_object (task));
+
+  self->priv->connection = tracker_sparql_connection_get_finish (res, &error);
+  if (G_UNLIKELY (self->priv->connection == NULL))
+    {
+      g_prefix_error (&error, "Unable to connect to Tracker store: ");
+      gom_miner_init_take_error (task, error);
+    }
+
+  gom_miner_init_complete (task);
+}
+
+static void
+gom_miner_init_async (GAsyncInitable *initable,
+                      gint io_priority,
+                      GCancellable *cancellable,
+                      GAsyncReadyCallback callback,
+                      gpointer user_data)
+{
+  GomMiner *self = GOM_MINER (initable);
+  GTask *task;
+  InitData *data;
+
+  g_return_if_fail (!self->priv->is_initialized);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_priority (task, io_priority);
+
+  data = g_slice_new0 (InitData);
+  g_task_set_task_data (task, data, (GDestroyNotify) init_data_free);
+
+  /* Both services might need to be activated, so wait for them
+   * at the same time instead of one after the other.
+   */
+  data->pending++;
+  tracker_sparql_connection_get_async (cancellable, gom_miner_init_tracker_cb, g_object_ref (task));
+
+  if (shared_client != NULL)
+    {
+      self->priv->client = g_object_ref (shared_client);
+    }
+  else
+    {
+      data->pending++;
+      goa_client_new (cancellable, gom_miner_init_goa_cb, g_object_ref (task));
+    }
+
+  g_object_unref (task);
+}
+
+static gboolean
+gom_miner_init_finish (GAsyncInitable *initable,
+                       GAsyncResult *res,
+                       GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (res, initable), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (res), error);
 }
 
 static void
-gom_miner_initable_iface_init (GInitableIface *iface)
+gom_miner_async_initable_iface_init (GAsyncInitableIface *iface)
 {
-  iface->init = gom_miner_initable_init;
+  iface->init_async = gom_miner_init_async;
+  iface->init_finish = gom_miner_init_finish;
 }
 
 static void
@@ -231,6 +414,8 @@ gom_miner_check_pending_jobs (GTask *task)
     return;
 
   g_task_return_boolean (task, TRUE);
+  g_strfreev (cleanup_job->index_types);
+  g_key_file_unref (cleanup_job->config);
   g_slice_free (CleanupJob, cleanup_job);
 }
 
@@ -254,15 +439,39 @@ gom_miner_ensure_datasource (GomMiner *self,
                           datasource_urn, klass->miner_identifier,
                           root_element_urn, datasource_urn, klass->version);
 
-  tracker_sparql_connection_update (self->priv->connection,
-                                    datasource_insert->str,
-                                    G_PRIORITY_DEFAULT,
-                                    cancellable,
-                                    error);
+  gom_tracker_sparql_connection_update (self->priv->connection,
+                                        datasource_insert->str,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        error);
 
   g_string_free (datasource_insert, TRUE);
 }
 
+/* Photos and albums; everything else in a datasource is a document or
+ * a folder.
+ */
+#define PHOTOS_PATTERN "EXISTS { ?urn a nmm:Photo } || fn:starts-with (?id, \"photos:collection:\")"
+
+static const gchar *
+gom_account_miner_job_get_type_filter (GomAccountMinerJob *job)
+{
+  gboolean documents;
+  gboolean photos;
+
+  documents = gom_miner_supports_type ((const gchar **) job->index_types, "documents");
+  photos = gom_miner_supports_type ((const gchar **) job->index_types, "photos");
+
+  if (documents && photos)
+    return "";
+  else if (photos)
+    return "FILTER (" PHOTOS_PATTERN ")";
+  else if (documents)
+    return "FILTER (!(" PHOTOS_PATTERN "))";
+  else
+    return "FILTER (false)";
+}
+
 static void
 gom_account_miner_job_query_existing (GomAccountMinerJob *job,
                                       GError **error)
@@ -273,10 +482,16 @@ gom_account_miner_job_query_existing (GomAccountMinerJob *job,
 
   cancellable = g_task_get_cancellable (job->task);
 
+  /* Only consider the resources of the index types being refreshed.
+   * Otherwise, the ones that belong to the other types would be
+   * deleted, and a concurrent refresh of those types would step on
+   * this one.
+   */
   select = g_string_new (NULL);
   g_string_append_printf (select,
-                          "SELECT ?urn nao:identifier(?urn) WHERE { ?urn nie:dataSource <%s> }",
-                          job->datasource_urn);
+                          "SELECT ?urn ?id WHERE { ?urn nie:dataSource <%s> ; nao:identifier ?id . %s }",
+                          job->datasource_urn,
+                          gom_account_miner_job_get_type_filter (job));
 
   cursor = tracker_sparql_connection_query (job->connection,
                                             select->str,
@@ -329,15 +544,127 @@ gom_account_miner_job_cleanup_previous (GomAccountMinerJob *job,
 
   g_string_append (delete, "}");
 
-  tracker_sparql_connection_update (job->connection,
-                                    delete->str,
-                                    G_PRIORITY_DEFAULT,
-                                    cancellable,
-                                    error);
+  gom_tracker_sparql_connection_update (job->connection,
+                                        delete->str,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        error);
 
   g_string_free (delete, TRUE);
 }
 
+static gchar *
+gom_account_miner_job_get_sync_urn (GomAccountMinerJob *job, const gchar *type)
+{
+  return g_strdup_printf ("%s:sync:%s", job->datasource_urn, type);
+}
+
+static gboolean
+gom_account_miner_job_is_fresh (GomAccountMinerJob *job,
+                                GError **error)
+{
+  GCancellable *cancellable;
+  gboolean retval = FALSE;
+  gint64 now;
+  gint min_refresh_interval;
+  guint i;
+
+  if (job->force)
+    goto out;
+
+  min_refresh_interval = gom_account_miner_job_get_config_int (job,
+                                                               "min-refresh-interval",
+                                                               DEFAULT_MIN_REFRESH_INTERVAL);
+  if (min_refresh_interval <= 0)
+    goto out;
+
+  cancellable = g_task_get_cancellable (job->task);
+  now = g_get_real_time () / G_USEC_PER_SEC;
+
+  /* fresh only if every requested type was refreshed recently */
+  for (i = 0; job->index_types[i] != NULL; i++)
+    {
+      GString *select;
+      GTimeVal last_refreshed;
+      TrackerSparqlCursor *cursor;
+      gboolean fresh = FALSE;
+      gchar *sync_urn;
+
+      sync_urn = gom_account_miner_job_get_sync_urn (job, job->index_types[i]);
+
+      select = g_string_new (NULL);
+      g_string_append_printf (select, "SELECT ?time WHERE { <%s> nie:lastRefreshed ?time }", sync_urn);
+
+      cursor = tracker_sparql_connection_query (job->connection,
+                                                select->str,
+                                                cancellable,
+                                                error);
+      g_string_free (select, TRUE);
+      g_free (sync_urn);
+
+      if (cursor == NULL)
+        goto out;
+
+      if (tracker_sparql_cursor_next (cursor, cancellable, NULL)
+          && g_time_val_from_iso8601 (tracker_sparql_cursor_get_string (cursor, 0, NULL), &last_refreshed))
+        {
+          fresh = (now - last_refreshed.tv_sec >= 0
+                   && now - last_refreshed.tv_sec < min_refresh_interval);
+        }
+
+      g_object_unref (cursor);
+
+      if (!fresh)
+        goto out;
+    }
+
+  retval = TRUE;
+
+ out:
+  return retval;
+}
+
+static void
+gom_account_miner_job_update_last_refreshed (GomAccountMinerJob *job,
+                                             GError **error)
+{
+  GCancellable *cancellable;
+  GString *update;
+  gchar *now;
+  guint i;
+
+  cancellable = g_task_get_cancellable (job->task);
+  now = gom_iso8601_from_timestamp (g_get_real_time () / G_USEC_PER_SEC);
+
+  /* The sync state lives in the account's datasource, next to the
+   * root element, so that it goes away together with the account.
+   */
+  update = g_string_new (NULL);
+  for (i = 0; job->index_types[i] != NULL; i++)
+    {
+      gchar *sync_urn;
+
+      sync_urn = gom_account_miner_job_get_sync_urn (job, job->index_types[i]);
+      g_string_append_printf (update,
+                              "INSERT OR REPLACE INTO <%s> {"
+                              "  <%s> a nie:DataObject, nie:InformationElement ;"
+                              "    nie:dataSource <%s> ; nie:lastRefreshed \"%s\""
+                              "} ",
+                              job->datasource_urn,
+                              sync_urn, job->datasource_urn, now);
+      g_free (sync_urn);
+    }
+
+  gom_tracker_sparql_connection_update (job->connection,
+                                        update->str,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        error);
+
+  g_string_free (update, TRUE);
+  g_free (now);
+}
+
 static void
 gom_account_miner_job_query (GomAccountMinerJob *job,
                              GError **error)
@@ -349,6 +676,31 @@ gom_account_miner_job_query (GomAccountMinerJob *job,
   miner_class->query (job, job->connection, job->previous_resources, job->datasource_urn, cancellable, error);
 }
 
+static void
+gom_account_miner_job_log_stats (GomAccountMinerJob *job)
+{
+  struct rusage usage;
+  gint64 elapsed;
+  gint n_entries;
+
+  elapsed = (g_get_monotonic_time () - job->start_time) / 1000;
+  n_entries = g_atomic_int_get (&job->n_entries);
+
+  /* ru_maxrss covers the whole process, and is in KiB on Linux */
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    usage.ru_maxrss = 0;
+
+  g_debug ("Account %s: %d entries in %d requests and %d updates in %" G_GINT64_FORMAT " ms "
+           "(%.1f entries/s, peak RSS %ld KiB)",
+           goa_account_get_id (job->account),
+           n_entries,
+           g_atomic_int_get (&job->n_requests),
+           g_atomic_int_get (&job->n_updates),
+           elapsed,
+           (elapsed > 0) ? n_entries * 1000.0 / elapsed : 0.0,
+           usage.ru_maxrss);
+}
+
 static void
 gom_account_miner_job (GTask *task,
                        gpointer source_object,
@@ -358,6 +710,21 @@ gom_account_miner_job (GTask *task,
   GomAccountMinerJob *job = task_data;
   GError *error = NULL;
 
+  job->start_time = g_get_monotonic_time ();
+
+  /* the miners write from this thread, unless they say otherwise */
+  gom_tracker_set_update_counter (&job->n_updates);
+
+  if (gom_account_miner_job_is_fresh (job, &error))
+    {
+      g_debug ("Skipping account %s, it was refreshed recently",
+               goa_account_get_id (job->account));
+      goto out;
+    }
+
+  if (error != NULL)
+    goto out;
+
   gom_miner_ensure_datasource (job->miner, job->datasource_urn, job->root_element_urn, cancellable, &error);
 
   if (error != NULL)
@@ -378,7 +745,15 @@ gom_account_miner_job (GTask *task,
   if (error != NULL)
     goto out;
 
+  gom_account_miner_job_update_last_refreshed (job, &error);
+
+  if (error != NULL)
+    goto out;
+
  out:
+  gom_tracker_set_update_counter (NULL);
+  gom_account_miner_job_log_stats (job);
+
   if (error != NULL)
     g_task_return_error (job->task, error);
   else
@@ -416,14 +791,134 @@ gom_account_miner_job_process_finish (GAsyncResult *res,
   return g_task_propagate_boolean (task, error);
 }
 
+static GHashTable *
+gom_miner_ensure_account_services (GomMiner *self,
+                                   const gchar *account_id)
+{
+  GHashTable *account_services;
+
+  account_services = g_hash_table_lookup (self->priv->services, account_id);
+  if (account_services == NULL)
+    {
+      account_services = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify) g_hash_table_unref);
+      g_hash_table_insert (self->priv->services, g_strdup (account_id), account_services);
+    }
+
+  return account_services;
+}
+
+static gint
+compare_strings (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* the same types, in any order, share the same services */
+static gchar *
+get_types_key (const gchar **index_types)
+{
+  const gchar **types;
+  gchar *retval;
+  guint n_types;
+
+  n_types = g_strv_length ((gchar **) index_types);
+  types = g_memdup (index_types, (n_types + 1) * sizeof (gchar *));
+  qsort (types, n_types, sizeof (gchar *), compare_strings);
+
+  retval = g_strjoinv (",", (gchar **) types);
+  g_free (types);
+
+  return retval;
+}
+
+static GHashTable *
+gom_miner_dup_services (GomMiner *self,
+                        GoaObject *object,
+                        const gchar **index_types)
+{
+  GHashTable *account_services;
+  GHashTable *services;
+  GoaAccount *account;
+  GomMinerClass *miner_class = GOM_MINER_GET_CLASS (self);
+  const gchar *account_id;
+  gchar *types_key;
+
+  account = goa_object_peek_account (object);
+  account_id = goa_account_get_id (account);
+
+  account_services = gom_miner_ensure_account_services (self, account_id);
+
+  /* the set of services depends on the requested index types */
+  types_key = get_types_key (index_types);
+
+  services = g_hash_table_lookup (account_services, types_key);
+  if (services == NULL)
+    {
+      g_debug ("Creating services for account %s (%s)", account_id, types_key);
+      services = miner_class->create_services (self, object, index_types);
+      g_hash_table_insert (account_services, types_key, services);
+      types_key = NULL;
+    }
+
+  g_free (types_key);
+  return g_hash_table_ref (services);
+}
+
+static gpointer
+gom_miner_dup_service (GomMiner *self,
+                       GoaObject *object,
+                       const gchar *type)
+{
+  GHashTable *account_services;
+  GHashTable *services;
+  GHashTableIter iter;
+  GoaAccount *account;
+  GomMinerClass *miner_class = GOM_MINER_GET_CLASS (self);
+  const gchar *account_id;
+  gpointer service = NULL;
+
+  account = goa_object_peek_account (object);
+  account_id = goa_account_get_id (account);
+
+  account_services = gom_miner_ensure_account_services (self, account_id);
+
+  g_hash_table_iter_init (&iter, account_services);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &services))
+    {
+      service = g_hash_table_lookup (services, type);
+      if (service != NULL)
+        return g_object_ref (service);
+    }
+
+  if (miner_class->create_service == NULL)
+    return NULL;
+
+  service = miner_class->create_service (self, object, type);
+  if (service == NULL)
+    return NULL;
+
+  /* This is what create_services would return if only this type was
+   * requested, so a later refresh of just this type can use it too.
+   */
+  services = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                    g_free, (GDestroyNotify) g_object_unref);
+  g_hash_table_insert (services, g_strdup (type), g_object_ref (service));
+  g_hash_table_insert (account_services, g_strdup (type), services);
+
+  return service;
+}
+
 static GomAccountMinerJob *
 gom_account_miner_job_new (GomMiner *self,
                            GoaObject *object,
                            GTask *parent_task)
 {
+  CleanupJob *cleanup_job;
   GomAccountMinerJob *retval;
   GoaAccount *account;
-  GomMinerClass *miner_class = GOM_MINER_GET_CLASS (self);
+
+  cleanup_job = (CleanupJob *) g_task_get_task_data (parent_task);
 
   account = goa_object_get_account (object);
   g_assert (account != NULL);
@@ -437,7 +932,11 @@ gom_account_miner_job_new (GomMiner *self,
     g_hash_table_new_full (g_str_hash, g_str_equal,
                            (GDestroyNotify) g_free, (GDestroyNotify) g_free);
 
-  retval->services = miner_class->create_services (self, object);
+  retval->index_types = g_strdupv (cleanup_job->index_types);
+  retval->config = g_key_file_ref (cleanup_job->config);
+  retval->force = cleanup_job->force;
+  gom_account_miner_job_load_path_rules (retval);
+  retval->services = gom_miner_dup_services (self, object, (const gchar **) retval->index_types);
   retval->datasource_urn = g_strdup_printf ("gd:goa-account:%s",
                                             goa_account_get_id (retval->account));
   retval->root_element_urn = g_strdup_printf ("gd:goa-account:%s:root-element",
@@ -566,11 +1065,11 @@ cleanup_job_do_cleanup (CleanupJob *job, GCancellable *cancellable)
                               resource);
     }
 
-  tracker_sparql_connection_update (self->priv->connection,
-                                    update->str,
-                                    G_PRIORITY_DEFAULT,
-                                    cancellable,
-                                    &error);
+  gom_tracker_sparql_connection_update (self->priv->connection,
+                                        update->str,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        &error);
   g_string_free (update, TRUE);
 
   if (error != NULL)
@@ -696,6 +1195,8 @@ static void
 gom_miner_cleanup_old_accounts (GomMiner *self,
                                 GList *content_objects,
                                 GList *acc_objects,
+                                const gchar **index_types,
+                                gboolean force,
                                 GTask *task)
 {
   CleanupJob *job = g_slice_new0 (CleanupJob);
@@ -703,13 +1204,16 @@ gom_miner_cleanup_old_accounts (GomMiner *self,
   job->self = g_object_ref (self);
   job->content_objects = content_objects;
   job->acc_objects = acc_objects;
+  job->index_types = g_strdupv ((gchar **) index_types);
+  job->config = gom_config_key_file_load ();
+  job->force = force;
 
   g_task_set_task_data (task, job, NULL);
   g_thread_pool_push (cleanup_pool, g_object_ref (task), NULL);
 }
 
 static void
-gom_miner_refresh_db_real (GomMiner *self, GTask *task)
+gom_miner_refresh_db_real (GomMiner *self, const gchar **index_types, gboolean force, GTask *task)
 {
   GoaFiles *files;
   GoaPhotos *photos;
@@ -742,10 +1246,10 @@ gom_miner_refresh_db_real (GomMiner *self, GTask *task)
       files = goa_object_peek_files (object);
       photos = goa_object_peek_photos (object);
 
-      if (gom_miner_supports_type (self, "photos") && photos != NULL)
+      if (gom_miner_supports_type (index_types, "photos") && photos != NULL)
         skip_photos = FALSE;
 
-      if (gom_miner_supports_type (self, "documents") && files != NULL)
+      if (gom_miner_supports_type (index_types, "documents") && files != NULL)
         skip_documents = FALSE;
 
       if (skip_photos && skip_documents)
@@ -756,7 +1260,7 @@ gom_miner_refresh_db_real (GomMiner *self, GTask *task)
 
   g_list_free_full (accounts, g_object_unref);
 
-  gom_miner_cleanup_old_accounts (self, content_objects, acc_objects, task);
+  gom_miner_cleanup_old_accounts (self, content_objects, acc_objects, index_types, force, task);
 }
 
 const gchar *
@@ -765,6 +1269,12 @@ gom_miner_get_display_name (GomMiner *self)
   return self->priv->display_name;
 }
 
+GoaClient *
+gom_miner_get_client (GomMiner *self)
+{
+  return self->priv->client;
+}
+
 static void
 gom_miner_insert_shared_content_in_thread_func (GTask *task,
                                                 gpointer source_object,
@@ -772,6 +1282,7 @@ gom_miner_insert_shared_content_in_thread_func (GTask *task,
                                                 GCancellable *cancellable)
 {
   GomMiner *self = GOM_MINER (source_object);
+  GomMinerClass *klass = GOM_MINER_GET_CLASS (self);
   GError *error;
   InsertSharedContentData *data = (InsertSharedContentData *) task_data;
   gchar *datasource_urn = NULL;
@@ -789,15 +1300,35 @@ gom_miner_insert_shared_content_in_thread_func (GTask *task,
     }
 
   error = NULL;
-  GOM_MINER_GET_CLASS (self)->insert_shared_content (self,
-                                                     data->service,
-                                                     self->priv->connection,
-                                                     datasource_urn,
-                                                     data->shared_id,
-                                                     data->shared_type,
-                                                     data->source_urn,
-                                                     cancellable,
-                                                     &error);
+  if (g_task_get_source_tag (task) == gom_miner_insert_shared_content_batch_async
+      && klass->insert_shared_content_batch != NULL)
+    {
+      klass->insert_shared_content_batch (self,
+                                          data->service,
+                                          self->priv->connection,
+                                          datasource_urn,
+                                          (const gchar **) data->shared_ids,
+                                          data->shared_type,
+                                          data->source_urn,
+                                          cancellable,
+                                          &error);
+    }
+  else
+    {
+      guint i;
+
+      for (i = 0; data->shared_ids[i] != NULL && error == NULL; i++)
+        klass->insert_shared_content (self,
+                                      data->service,
+                                      self->priv->connection,
+                                      datasource_urn,
+                                      data->shared_ids[i],
+                                      data->shared_type,
+                                      data->source_urn,
+                                      cancellable,
+                                      &error);
+    }
+
   if (error != NULL)
     {
       g_task_return_error (task, error);
@@ -811,26 +1342,20 @@ gom_miner_insert_shared_content_in_thread_func (GTask *task,
   g_free (root_element_urn);
 }
 
-void
-gom_miner_insert_shared_content_async (GomMiner *self,
-                                       const gchar *account_id,
-                                       const gchar *shared_id,
-                                       const gchar *shared_type,
-                                       const gchar *source_urn,
-                                       GCancellable *cancellable,
-                                       GAsyncReadyCallback callback,
-                                       gpointer user_data)
+static void
+gom_miner_insert_shared_content_real (GomMiner *self,
+                                      const gchar *account_id,
+                                      const gchar **shared_ids,
+                                      const gchar *shared_type,
+                                      const gchar *source_urn,
+                                      GTask *task)
 {
-  GTask *task = NULL;
   GoaFiles *files;
   GoaObject *object = NULL;
   GoaPhotos *photos;
   InsertSharedContentData *data;
   gpointer service;
 
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, gom_miner_insert_shared_content_async);
-
   object = goa_client_lookup_by_id (self->priv->client, account_id);
   if (object == NULL)
     {
@@ -853,20 +1378,42 @@ gom_miner_insert_shared_content_async (GomMiner *self,
       goto out;
     }
 
-  service = GOM_MINER_GET_CLASS (self)->create_service (self, object, shared_type);
+  service = gom_miner_dup_service (self, object, shared_type);
   if (service == NULL)
     {
       /* throw error */
       goto out;
     }
 
-  data = gom_insert_shared_content_data_new (self, account_id, shared_id, shared_type, source_urn, service);
+  data = gom_insert_shared_content_data_new (self, account_id, shared_ids, shared_type, source_urn, service);
   g_task_set_task_data (task, data, (GDestroyNotify) gom_insert_shared_content_data_free);
 
   g_task_run_in_thread (task, gom_miner_insert_shared_content_in_thread_func);
 
  out:
   g_clear_object (&object);
+}
+
+void
+gom_miner_insert_shared_content_async (GomMiner *self,
+                                       const gchar *account_id,
+                                       const gchar *shared_id,
+                                       const gchar *shared_type,
+                                       const gchar *source_urn,
+                                       GCancellable *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       gpointer user_data)
+{
+  GTask *task = NULL;
+  const gchar *shared_ids[2];
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gom_miner_insert_shared_content_async);
+
+  shared_ids[0] = shared_id;
+  shared_ids[1] = NULL;
+  gom_miner_insert_shared_content_real (self, account_id, shared_ids, shared_type, source_urn, task);
+
   g_clear_object (&task);
 }
 
@@ -883,8 +1430,41 @@ gom_miner_insert_shared_content_finish (GomMiner *self, GAsyncResult *res, GErro
   return g_task_propagate_boolean (task, error);
 }
 
+void
+gom_miner_insert_shared_content_batch_async (GomMiner *self,
+                                             const gchar *account_id,
+                                             const gchar **shared_ids,
+                                             const gchar *shared_type,
+                                             const gchar *source_urn,
+                                             GCancellable *cancellable,
+                                             GAsyncReadyCallback callback,
+                                             gpointer user_data)
+{
+  GTask *task = NULL;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gom_miner_insert_shared_content_batch_async);
+  gom_miner_insert_shared_content_real (self, account_id, shared_ids, shared_type, source_urn, task);
+  g_clear_object (&task);
+}
+
+gboolean
+gom_miner_insert_shared_content_batch_finish (GomMiner *self, GAsyncResult *res, GError **error)
+{
+  GTask *task;
+
+  g_assert (g_task_is_valid (res, self));
+  task = G_TASK (res);
+
+  g_assert (g_task_get_source_tag (task) == gom_miner_insert_shared_content_batch_async);
+
+  return g_task_propagate_boolean (task, error);
+}
+
 void
 gom_miner_refresh_db_async (GomMiner *self,
+                            const gchar **index_types,
+                            gboolean force,
                             GCancellable *cancellable,
                             GAsyncReadyCallback callback,
                             gpointer user_data)
@@ -893,7 +1473,7 @@ gom_miner_refresh_db_async (GomMiner *self,
 
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, gom_miner_refresh_db_async);
-  gom_miner_refresh_db_real (self, task);
+  gom_miner_refresh_db_real (self, index_types, force, task);
   g_clear_object (&task);
 }
 
@@ -912,28 +1492,376 @@ gom_miner_refresh_db_finish (GomMiner *self,
   return g_task_propagate_boolean (task, error);
 }
 
-void
-gom_miner_set_index_types (GomMiner *self, const char **index_types)
+gchar *
+gom_account_miner_job_dup_sync_token (GomAccountMinerJob *job,
+                                      const gchar *type,
+                                      GError **error)
+{
+  GCancellable *cancellable;
+  GString *select;
+  TrackerSparqlCursor *cursor;
+  gchar *sync_urn;
+  gchar *retval = NULL;
+
+  cancellable = g_task_get_cancellable (job->task);
+  sync_urn = gom_account_miner_job_get_sync_urn (job, type);
+
+  select = g_string_new (NULL);
+  g_string_append_printf (select, "SELECT ?token WHERE { <%s> nie:version ?token }", sync_urn);
+
+  cursor = tracker_sparql_connection_query (job->connection,
+                                            select->str,
+                                            cancellable,
+                                            error);
+  g_string_free (select, TRUE);
+
+  if (cursor == NULL)
+    goto out;
+
+  if (tracker_sparql_cursor_next (cursor, cancellable, error))
+    retval = g_strdup (tracker_sparql_cursor_get_string (cursor, 0, NULL));
+
+  g_object_unref (cursor);
+
+ out:
+  g_free (sync_urn);
+  return retval;
+}
+
+gboolean
+gom_account_miner_job_set_sync_token (GomAccountMinerJob *job,
+                                      const gchar *type,
+                                      const gchar *token,
+                                      GError **error)
+{
+  GCancellable *cancellable;
+  GError *local_error = NULL;
+  GString *update;
+  gchar *quoted;
+  gchar *sync_urn;
+
+  cancellable = g_task_get_cancellable (job->task);
+  sync_urn = gom_account_miner_job_get_sync_urn (job, type);
+
+  /* the "null" value must not be quoted, and drops the stored token */
+  if (token == NULL)
+    quoted = g_strdup ("null");
+  else
+    quoted = g_strdup_printf ("\"%s\"", token);
+
+  /* The token must go away together with the datasource, otherwise a
+   * wiped datasource would only ever receive the changes made after
+   * the token was stored.
+   */
+  update = g_string_new (NULL);
+  g_string_append_printf (update,
+                          "INSERT OR REPLACE INTO <%s> {"
+                          "  <%s> a nie:DataObject, nie:InformationElement ;"
+                          "    nie:dataSource <%s> ; nie:version %s"
+                          "}",
+                          job->datasource_urn,
+                          sync_urn, job->datasource_urn, quoted);
+
+  gom_tracker_sparql_connection_update (job->connection,
+                                        update->str,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        &local_error);
+
+  g_string_free (update, TRUE);
+  g_free (quoted);
+  g_free (sync_urn);
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* the account's own settings win over the provider's, which in turn
+ * win over the general ones
+ */
+static gchar *
+gom_account_miner_job_get_config_groups (GomAccountMinerJob *job, const gchar *groups[4])
 {
-  g_strfreev (self->priv->index_types);
-  self->priv->index_types = g_strdupv ((gchar **) index_types);
+  gchar *account_group;
+
+  account_group = g_strdup_printf ("account %s", goa_account_get_id (job->account));
+  groups[0] = account_group;
+  groups[1] = goa_account_get_provider_type (job->account);
+  groups[2] = "general";
+  groups[3] = NULL;
+
+  return account_group;
+}
+
+gint
+gom_account_miner_job_get_config_int (GomAccountMinerJob *job,
+                                      const gchar *key,
+                                      gint default_value)
+{
+  GError *error = NULL;
+  const gchar *groups[4];
+  gchar *account_group;
+  gint retval = default_value;
+  guint i;
+
+  account_group = gom_account_miner_job_get_config_groups (job, groups);
+
+  for (i = 0; groups[i] != NULL; i++)
+    {
+      gint value;
+
+      if (!g_key_file_has_key (job->config, groups[i], key, NULL))
+        continue;
+
+      value = g_key_file_get_integer (job->config, groups[i], key, &error);
+      if (error != NULL)
+        {
+          g_warning ("Invalid value for %s in [%s]: %s", key, groups[i], error->message);
+          g_clear_error (&error);
+          continue;
+        }
+
+      retval = value;
+      break;
+    }
+
+  g_free (account_group);
+  return retval;
+}
+
+gboolean
+gom_account_miner_job_get_config_boolean (GomAccountMinerJob *job,
+                                          const gchar *key,
+                                          gboolean default_value)
+{
+  GError *error = NULL;
+  const gchar *groups[4];
+  gboolean retval = default_value;
+  gchar *account_group;
+  guint i;
+
+  account_group = gom_account_miner_job_get_config_groups (job, groups);
+
+  for (i = 0; groups[i] != NULL; i++)
+    {
+      gboolean value;
+
+      if (!g_key_file_has_key (job->config, groups[i], key, NULL))
+        continue;
+
+      value = g_key_file_get_boolean (job->config, groups[i], key, &error);
+      if (error != NULL)
+        {
+          g_warning ("Invalid value for %s in [%s]: %s", key, groups[i], error->message);
+          g_clear_error (&error);
+          continue;
+        }
+
+      retval = value;
+      break;
+    }
+
+  g_free (account_group);
+  return retval;
+}
+
+gchar *
+gom_account_miner_job_dup_config_string (GomAccountMinerJob *job,
+                                         const gchar *key,
+                                         const gchar *default_value)
+{
+  const gchar *groups[4];
+  gchar *account_group;
+  gchar *retval = NULL;
+  guint i;
+
+  account_group = gom_account_miner_job_get_config_groups (job, groups);
+
+  for (i = 0; groups[i] != NULL && retval == NULL; i++)
+    retval = g_key_file_get_string (job->config, groups[i], key, NULL);
+
+  if (retval == NULL)
+    retval = g_strdup (default_value);
+
+  g_free (account_group);
+  return retval;
+}
+
+static GPtrArray *
+gom_account_miner_job_load_patterns (GomAccountMinerJob *job,
+                                     const gchar *key,
+                                     GPtrArray *strings,
+                                     GString *rules)
+{
+  GPtrArray *patterns;
+  const gchar *groups[4];
+  gchar **paths = NULL;
+  gchar *account_group;
+  guint i;
+
+  patterns = g_ptr_array_new_with_free_func ((GDestroyNotify) g_pattern_spec_free);
+  account_group = gom_account_miner_job_get_config_groups (job, groups);
+
+  for (i = 0; groups[i] != NULL && paths == NULL; i++)
+    paths = g_key_file_get_string_list (job->config, groups[i], key, NULL, NULL);
+
+  for (i = 0; paths != NULL && paths[i] != NULL; i++)
+    {
+      g_strstrip (paths[i]);
+      if (paths[i][0] == '\0')
+        continue;
+
+      g_ptr_array_add (patterns, g_pattern_spec_new (paths[i]));
+      g_string_append_printf (rules, "%s %s\n", key, paths[i]);
+
+      if (strings != NULL)
+        g_ptr_array_add (strings, g_strdup (paths[i]));
+    }
+
+  g_strfreev (paths);
+  g_free (account_group);
+  return patterns;
+}
+
+/* The include-paths and exclude-paths keys of
+ * ~/.config/gnome-online-miners/miners.conf take ';'-separated lists
+ * of globs, for instance exclude-paths=/Archive;*.tmp and
+ * include-paths=/Archive/keep. See gom_account_miner_job_is_path_excluded.
+ */
+static void
+gom_account_miner_job_load_path_rules (GomAccountMinerJob *job)
+{
+  GString *rules;
+
+  rules = g_string_new (NULL);
+  job->include_paths = g_ptr_array_new_with_free_func (g_free);
+  job->include_patterns = gom_account_miner_job_load_patterns (job, "include-paths", job->include_paths, rules);
+  job->exclude_patterns = gom_account_miner_job_load_patterns (job, "exclude-paths", NULL, rules);
+
+  /* the include rules used to be ignored without exclude rules, so
+   * the tags and sync tokens stored back then can't be trusted
+   */
+  if (rules->len > 0)
+    {
+      g_string_prepend (rules, "path-rules 2\n");
+      job->path_rules_checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, rules->str, -1);
+    }
+
+  g_string_free (rules, TRUE);
+}
+
+static gboolean
+gom_account_miner_job_match_patterns (GPtrArray *patterns, const gchar *path)
+{
+  guint i;
+
+  for (i = 0; i < patterns->len; i++)
+    {
+      if (g_pattern_match_string (g_ptr_array_index (patterns, i), path))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+gom_account_miner_job_apply_path_rules (GomAccountMinerJob *job, const gchar *path, gboolean excluded)
+{
+  if (gom_account_miner_job_match_patterns (job->include_patterns, path))
+    return FALSE;
+
+  if (gom_account_miner_job_match_patterns (job->exclude_patterns, path))
+    return TRUE;
+
+  return excluded;
+}
+
+/* whether an include-paths glob could match something below dir */
+static gboolean
+gom_account_miner_job_includes_below (GomAccountMinerJob *job, const gchar *dir)
+{
+  gboolean retval = FALSE;
+  gchar *dir_slash;
+  guint i;
+
+  dir_slash = g_strconcat (dir, "/", NULL);
+
+  for (i = 0; i < job->include_paths->len && !retval; i++)
+    {
+      const gchar *include = g_ptr_array_index (job->include_paths, i);
+      gchar *literal;
+      gsize length;
+
+      /* the part before the first wildcard */
+      length = strcspn (include, "*?");
+      literal = g_strndup (include, length);
+
+      if (g_str_has_prefix (literal, dir_slash))
+        retval = TRUE;
+      else if (include[length] != '\0' && g_str_has_prefix (dir_slash, literal))
+        retval = TRUE;
+
+      g_free (literal);
+    }
+
+  g_free (dir_slash);
+  return retval;
 }
 
-const gchar **
-gom_miner_get_index_types (GomMiner *self)
+/* Paths are relative to the root of the account and start with a
+ * '/'. When there are include-paths globs, only what they match is
+ * mined, otherwise everything that no exclude-paths glob matches is.
+ * The deepest of the path and its parents that matches a glob decides,
+ * and an include wins over an exclude on the same one, so
+ * include-paths=/Archive/keep brings it back from
+ * exclude-paths=/Archive. Excluded directories are still listed if an
+ * include glob can match below them. Safe to call from any thread.
+ */
+gboolean
+gom_account_miner_job_is_path_excluded (GomAccountMinerJob *job,
+                                        const gchar *path,
+                                        gboolean is_dir)
 {
-  return (const gchar **) self->priv->index_types;
+  gboolean retval;
+  gchar *prefix;
+  gchar *p;
+
+  if ((job->include_patterns->len == 0 && job->exclude_patterns->len == 0) || path[0] == '\0')
+    return FALSE;
+
+  retval = (job->include_patterns->len > 0);
+  prefix = g_strdup (path);
+
+  for (p = strchr (prefix + 1, '/'); p != NULL; p = strchr (p + 1, '/'))
+    {
+      *p = '\0';
+      retval = gom_account_miner_job_apply_path_rules (job, prefix, retval);
+      *p = '/';
+    }
+
+  retval = gom_account_miner_job_apply_path_rules (job, path, retval);
+
+  if (retval && is_dir)
+    retval = !gom_account_miner_job_includes_below (job, path);
+
+  g_free (prefix);
+  return retval;
 }
 
 gboolean
-gom_miner_supports_type (GomMiner *self, gchar *type)
+gom_miner_supports_type (const gchar **index_types, const gchar *type)
 {
   gboolean retval = FALSE;
   guint i;
 
-  for (i = 0; self->priv->index_types[i] != NULL; i++)
+  for (i = 0; index_types[i] != NULL; i++)
     {
-      if (g_strcmp0 (self->priv->index_types[i], type) == 0)
+      if (g_strcmp0 (index_types[i], type) == 0)
         {
           retval = TRUE;
           break;
@@ -64,12 +64,27 @@ typedef struct {
 
   GoaAccount *account;
   GHashTable *services;
+  gchar **index_types;
+  GKeyFile *config;
+  gboolean force;
   GTask *task;
   GTask *parent_task;
 
+  /* see gom_account_miner_job_is_path_excluded */
+  GPtrArray *include_patterns;
+  GPtrArray *include_paths;
+  GPtrArray *exclude_patterns;
+  gchar *path_rules_checksum;
+
   GHashTable *previous_resources;
   gchar *datasource_urn;
   gchar *root_element_urn;
+
+  /* statistics, logged when the job is done */
+  gint64 start_time;
+  volatile gint n_requests;
+  volatile gint n_entries;
+  volatile gint n_updates;
 } GomAccountMinerJob;
 
 struct _GomMiner
@@ -90,7 +105,8 @@ struct _GomMinerClass
   gpointer (*create_service) (GomMiner *self, GoaObject *object, const gchar *type);
 
   GHashTable * (*create_services) (GomMiner *self,
-                                   GoaObject *object);
+                                   GoaObject *object,
+                                   const gchar **index_types);
 
   void (*destroy_service) (GomMiner *self, gpointer service);
 
@@ -104,18 +120,36 @@ struct _GomMinerClass
                                  GCancellable *cancellable,
                                  GError **error);
 
+  /* optional, insert_shared_content is called for each ID otherwise */
+  void (*insert_shared_content_batch) (GomMiner *self,
+                                       gpointer service,
+                                       TrackerSparqlConnection *connection,
+                                       const gchar *datasource_urn,
+                                       const gchar **shared_ids,
+                                       const gchar *shared_type,
+                                       const gchar *source_urn,
+                                       GCancellable *cancellable,
+                                       GError **error);
+
   void (*query) (GomAccountMinerJob *job,
                  TrackerSparqlConnection *connection,
                  GHashTable *previous_resources,
                  const gchar *datasource_urn,
                  GCancellable *cancellable,
                  GError **error);
+
+  /* optional, called in the main context once the miner is
+   * initialized, to prepare for the first refresh
+   */
+  void (*setup) (GomMiner *self, GoaClient *client);
 };
 
 GType gom_miner_get_type (void);
 
 const gchar * gom_miner_get_display_name (GomMiner *self);
 
+GoaClient * gom_miner_get_client (GomMiner *self);
+
 void gom_miner_insert_shared_content_async (GomMiner *self,
                                             const gchar *account_id,
                                             const gchar *shared_id,
@@ -127,7 +161,20 @@ void gom_miner_insert_shared_content_async (GomMiner *self,
 
 gboolean gom_miner_insert_shared_content_finish (GomMiner *self, GAsyncResult *res, GError **error);
 
+void gom_miner_insert_shared_content_batch_async (GomMiner *self,
+                                                  const gchar *account_id,
+                                                  const gchar **shared_ids,
+                                                  const gchar *shared_type,
+                                                  const gchar *source_urn,
+                                                  GCancellable *cancellable,
+                                                  GAsyncReadyCallback callback,
+                                                  gpointer user_data);
+
+gboolean gom_miner_insert_shared_content_batch_finish (GomMiner *self, GAsyncResult *res, GError **error);
+
 void gom_miner_refresh_db_async (GomMiner *self,
+                                 const gchar **index_types,
+                                 gboolean force,
                                  GCancellable *cancellable,
                                  GAsyncReadyCallback callback,
                                  gpointer user_data);
@@ -136,11 +183,32 @@ gboolean gom_miner_refresh_db_finish (GomMiner *self,
                                       GAsyncResult *res,
                                       GError **error);
 
-void gom_miner_set_index_types (GomMiner *self, const gchar **index_types);
+gchar *gom_account_miner_job_dup_sync_token (GomAccountMinerJob *job,
+                                             const gchar *type,
+                                             GError **error);
+
+gboolean gom_account_miner_job_set_sync_token (GomAccountMinerJob *job,
+                                               const gchar *type,
+                                               const gchar *token,
+                                               GError **error);
+
+gint gom_account_miner_job_get_config_int (GomAccountMinerJob *job,
+                                           const gchar *key,
+                                           gint default_value);
+
+gboolean gom_account_miner_job_get_config_boolean (GomAccountMinerJob *job,
+                                                   const gchar *key,
+                                                   gboolean default_value);
+
+gchar *gom_account_miner_job_dup_config_string (GomAccountMinerJob *job,
+                                                const gchar *key,
+                                                const gchar *default_value);
 
-const gchar ** gom_miner_get_index_types (GomMiner *self);
+gboolean gom_account_miner_job_is_path_excluded (GomAccountMinerJob *job,
+                                                 const gchar *path,
+                                                 gboolean is_dir);
 
-gboolean gom_miner_supports_type (GomMiner *self, gchar *type);
+gboolean gom_miner_supports_type (const gchar **index_types, const gchar *type);
 
 G_END_DECLS
 
@@ -0,0 +1,147 @@
+/*
+ * GNOME Online Miners - crawls through your online content
+ * Copyright (c) 2011 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Author: Cosimo Cecchi <cosimoc@redhat.com>
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+#include <glib.h>
+
+#include "gom-application.h"
+#include "tracker-ioprio.h"
+#include "tracker-sched.h"
+
+#ifdef ENABLE_FACEBOOK_MINER
+#include "gom-facebook-miner.h"
+#endif
+#ifdef ENABLE_FLICKR_MINER
+#include "gom-flickr-miner.h"
+#endif
+#ifdef ENABLE_GDATA_MINER
+#include "gom-gdata-miner.h"
+#endif
+#ifdef ENABLE_MEDIA_SERVER_MINER
+#include "gom-media-server-miner.h"
+#endif
+#ifdef ENABLE_OWNCLOUD_MINER
+#include "gom-owncloud-miner.h"
+#endif
+#ifdef ENABLE_ZPJ_MINER
+#include "gom-zpj-miner.h"
+#endif
+
+#define MINERS_BUS_NAME "org.gnome.OnlineMiners"
+
+typedef struct
+{
+  const gchar *name;
+  const gchar *bus_name;
+  GType (*get_type) (void);
+} MinerInfo;
+
+static const MinerInfo miners[] =
+{
+#ifdef ENABLE_FACEBOOK_MINER
+  { "FACEBOOK", "org.gnome.OnlineMiners.Facebook", gom_facebook_miner_get_type },
+#endif
+#ifdef ENABLE_FLICKR_MINER
+  { "FLICKR", "org.gnome.OnlineMiners.Flickr", gom_flickr_miner_get_type },
+#endif
+#ifdef ENABLE_GDATA_MINER
+  { "GDATA", "org.gnome.OnlineMiners.GData", gom_gdata_miner_get_type },
+#endif
+#ifdef ENABLE_MEDIA_SERVER_MINER
+  { "MEDIA_SERVER", "org.gnome.OnlineMiners.MediaServer", gom_media_server_miner_get_type },
+#endif
+#ifdef ENABLE_OWNCLOUD_MINER
+  { "OWNCLOUD", "org.gnome.OnlineMiners.Owncloud", gom_owncloud_miner_get_type },
+#endif
+#ifdef ENABLE_ZPJ_MINER
+  { "ZPJ", "org.gnome.OnlineMiners.Zpj", gom_zpj_miner_get_type },
+#endif
+  { NULL, NULL, NULL }
+};
+
+static gboolean
+signal_handler_cb (gpointer user_data)
+{
+  GApplication *app = user_data;
+
+  g_application_quit (app);
+  return FALSE;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  GApplication *app;
+  gint exit_status;
+  guint i;
+
+  tracker_sched_idle ();
+  tracker_ioprio_init ();
+
+  errno = 0;
+  if (nice (19) == -1 && errno != 0)
+    {
+      const gchar *str;
+
+      str = g_strerror (errno);
+      g_warning ("Couldn't set nice value to 19, %s", (str != NULL) ? str : "no error given");
+    }
+
+  /* All the miners share this process, and with it the GOA client,
+   * the Tracker connection and the cleanup thread pool. Each one is
+   * still exported under the bus name of its stand-alone binary, so
+   * that clients can not tell the difference.
+   */
+  app = gom_application_new_combined (MINERS_BUS_NAME);
+  for (i = 0; miners[i].name != NULL; i++)
+    {
+      gchar *persist;
+
+      gom_application_add_miner (GOM_APPLICATION (app), miners[i].bus_name, miners[i].get_type ());
+
+      persist = g_strconcat (miners[i].name, "_MINER_PERSIST", NULL);
+      if (g_getenv (persist) != NULL)
+        g_application_hold (app);
+      g_free (persist);
+    }
+
+  g_unix_signal_add_full (G_PRIORITY_DEFAULT,
+			  SIGTERM,
+			  signal_handler_cb,
+			  app, NULL);
+  g_unix_signal_add_full (G_PRIORITY_DEFAULT,
+			  SIGINT,
+			  signal_handler_cb,
+			  app, NULL);
+
+  exit_status = g_application_run (app, argc, argv);
+  g_object_unref (app);
+
+  return exit_status;
+}
@@ -23,31 +23,104 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <goa/goa.h>
 
 #include "gom-owncloud-miner.h"
 #include "gom-utils.h"
+#include "gom-webdav.h"
 
 #define MINER_IDENTIFIER "gd:owncloud:miner:8a409711-8fea-4eda-a417-f140ffc6d8f3"
 
 G_DEFINE_TYPE (GomOwncloudMiner, gom_owncloud_miner, GOM_TYPE_MINER)
 
 struct _GomOwncloudMinerPrivate {
+  GCond cond;
+  GHashTable *mounts;
+  GMainContext *context;
+  GMutex mutex;
   GVolumeMonitor *monitor;
 };
 
 #define FILE_ATTRIBUTES \
+  G_FILE_ATTRIBUTE_ETAG_VALUE "," \
   G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE "," \
   G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," \
   G_FILE_ATTRIBUTE_STANDARD_NAME "," \
   G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
   G_FILE_ATTRIBUTE_TIME_MODIFIED
 
+/* some GVfs backends sniff the contents, or make extra requests, for
+ * standard::content-type, while the fast variant only looks at the name
+ */
+#define FAST_FILE_ATTRIBUTES \
+  G_FILE_ATTRIBUTE_ETAG_VALUE "," \
+  G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE "," \
+  G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," \
+  G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+static const gint TRAVERSE_CONCURRENCY = 4;
+static const gint NEXT_FILES_BATCH = 100;
+static const guint VOLUME_TIMEOUT = 30;
+static const guint MOUNT_TIMEOUT = 60;
+
+typedef enum {
+  MOUNT_STATE_IDLE,
+  MOUNT_STATE_WAITING_FOR_VOLUME,
+  MOUNT_STATE_MOUNTING,
+  MOUNT_STATE_MOUNTED,
+  MOUNT_STATE_FAILED
+} MountStateKind;
+
+/* Where the GVfs volume of an account is at. The main context moves it
+ * along, and the refresh threads wait for it to be mounted or to fail.
+ * Both take the miner's mutex to look at kind, volume, mount, error and
+ * removed, and at the mounts table. A state stays alive for as long as someone
+ * holds a reference, even after its account is removed.
+ */
 typedef struct {
-  GError **error;
-  GMainLoop *loop;
-  GomAccountMinerJob *job;
-} SyncData;
+  GomOwncloudMiner *self;
+  GCancellable *cancellable;
+  GError *error;
+  GMount *mount;
+  GVolume *volume;
+  GoaObject *object;
+  MountStateKind kind;
+  gboolean removed;
+  guint timeout_id;
+  volatile gint ref_count;
+} MountState;
+
+static void
+append_property (GString *update, const gchar *property_name, const gchar *property_value)
+{
+  gchar *escaped;
+
+  escaped = tracker_sparql_escape_string (property_value);
+  g_string_append_printf (update, " ; %s \"%s\"", property_name, escaped);
+  g_free (escaped);
+}
+
+/* 64-bit FNV-1a, which is plenty to tell the URIs of an account apart
+ * and a lot cheaper than MD5
+ */
+static gchar *
+get_identifier (const gchar *uri, gboolean is_dir)
+{
+  guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+  const guchar *p;
+
+  for (p = (const guchar *) uri; *p != '\0'; p++)
+    {
+      hash ^= *p;
+      hash *= G_GUINT64_CONSTANT (1099511628211);
+    }
+
+  return g_strdup_printf ("%sowncloud:%016" G_GINT64_MODIFIER "x", is_dir ? "gd:collection:" : "", hash);
+}
 
 static gboolean
 account_miner_job_process_file (GomAccountMinerJob *job,
@@ -56,11 +129,12 @@ account_miner_job_process_file (GomAccountMinerJob *job,
                                 const gchar *datasource_urn,
                                 GFile *file,
                                 GFileInfo *info,
-                                GFile *parent,
+                                const gchar *parent_identifier,
+                                gchar **parent_resource_urn,
+                                GString *update,
                                 GCancellable *cancellable,
                                 GError **error)
 {
-  GChecksum *checksum = NULL;
   GDateTime *modification_time;
   GFileType type;
   GTimeVal tv;
@@ -68,8 +142,11 @@ account_miner_job_process_file (GomAccountMinerJob *job,
   gboolean resource_exists;
   const gchar *class;
   const gchar *display_name;
-  const gchar *id;
+  const gchar *mime;
   const gchar *name;
+  gchar *date;
+  gchar *guessed_type = NULL;
+  gchar *guessed_mime = NULL;
   gchar *identifier = NULL;
   gchar *resource = NULL;
   gchar *uri = NULL;
@@ -77,12 +154,7 @@ account_miner_job_process_file (GomAccountMinerJob *job,
 
   type = g_file_info_get_file_type (info);
   uri = g_file_get_uri (file);
-
-  checksum = g_checksum_new (G_CHECKSUM_MD5);
-  g_checksum_update (checksum, uri, -1);
-  id = g_checksum_get_string (checksum);
-  identifier = g_strdup_printf ("%sowncloud:%s", (type == G_FILE_TYPE_DIRECTORY ? "gd:collection:" : ""), id);
-  g_checksum_reset (checksum);
+  identifier = get_identifier (uri, type == G_FILE_TYPE_DIRECTORY);
 
   /* remove from the list of the previous resources */
   g_hash_table_remove (previous_resources, identifier);
@@ -116,9 +188,10 @@ account_miner_job_process_file (GomAccountMinerJob *job,
   g_file_info_get_modification_time (info, &tv);
   modification_time = g_date_time_new_from_timeval_local (&tv);
   new_mtime = g_date_time_to_unix (modification_time);
-  mtime_changed = gom_tracker_update_mtime (connection, new_mtime,
-                                            resource_exists, identifier, resource,
-                                            cancellable, error);
+  g_date_time_unref (modification_time);
+  mtime_changed = gom_tracker_mtime_changed (connection, new_mtime,
+                                             resource_exists, resource,
+                                             cancellable, error);
 
   if (*error != NULL)
     goto out;
@@ -129,80 +202,56 @@ account_miner_job_process_file (GomAccountMinerJob *job,
   if (!mtime_changed)
     goto out;
 
-  /* the resource changed - just set all the properties again */
-  gom_tracker_sparql_connection_insert_or_replace_triple
-    (connection,
-     cancellable, error,
-     datasource_urn, resource,
-     "nie:url", uri);
+  /* the parent is the same for all the files in a directory, so the
+   * caller keeps it around
+   */
+  if (type == G_FILE_TYPE_REGULAR && parent_identifier != NULL && *parent_resource_urn == NULL)
+    {
+      *parent_resource_urn = gom_tracker_sparql_connection_ensure_resource
+        (connection, cancellable, error,
+         NULL,
+         datasource_urn, parent_identifier,
+         "nfo:RemoteDataObject", "nfo:DataContainer", NULL);
 
-  if (*error != NULL)
-    goto out;
+      if (*error != NULL)
+        goto out;
+    }
 
-  if (type == G_FILE_TYPE_REGULAR)
-    {
-      const gchar *mime;
-      const gchar *parent_id;
-      gchar *parent_identifier;
-      gchar *parent_resource_urn;
-      gchar *parent_uri;
+  /* the resource changed - just set all the properties again, they
+   * are written together with the rest of the batch. So is the mtime,
+   * so that the entry is written again if the batch fails.
+   */
+  g_string_append_printf (update, "<%s> a nie:InformationElement", resource);
+  append_property (update, "nie:url", uri);
 
-      if (parent != NULL)
-        {
-          parent_uri = g_file_get_uri (parent);
-          g_checksum_update (checksum, parent_uri, -1);
-          parent_id = g_checksum_get_string (checksum);
-          parent_identifier = g_strconcat ("gd:collection:owncloud:", parent_id, NULL);
-          parent_resource_urn = gom_tracker_sparql_connection_ensure_resource
-            (connection, cancellable, error,
-             NULL,
-             datasource_urn, parent_identifier,
-             "nfo:RemoteDataObject", "nfo:DataContainer", NULL);
-          g_checksum_reset (checksum);
-          g_free (parent_identifier);
-          g_free (parent_uri);
-
-          if (*error != NULL)
-            goto out;
-
-          gom_tracker_sparql_connection_insert_or_replace_triple
-            (connection,
-             cancellable, error,
-             datasource_urn, resource,
-             "nie:isPartOf", parent_resource_urn);
-          g_free (parent_resource_urn);
-
-          if (*error != NULL)
-            goto out;
-        }
+  date = gom_iso8601_from_timestamp (new_mtime);
+  append_property (update, "nie:contentLastModified", date);
+  g_free (date);
 
-      mime = g_file_info_get_content_type (info);
-      if (mime != NULL)
-        {
-          gom_tracker_sparql_connection_insert_or_replace_triple
-            (connection,
-             cancellable, error,
-             datasource_urn, resource,
-             "nie:mimeType", mime);
-
-          if (*error != NULL)
-            goto out;
-        }
+  if (type == G_FILE_TYPE_REGULAR && parent_identifier != NULL)
+    g_string_append_printf (update, " ; nie:isPartOf <%s>", *parent_resource_urn);
+
+  mime = g_file_info_get_content_type (info);
+  if (mime == NULL)
+    mime = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+  if (type == G_FILE_TYPE_REGULAR && mime == NULL)
+    {
+      guessed_type = g_content_type_guess (name, NULL, 0, NULL);
+      guessed_mime = g_content_type_get_mime_type (guessed_type);
+      mime = guessed_mime;
     }
 
+  if (type == G_FILE_TYPE_REGULAR && mime != NULL)
+    append_property (update, "nie:mimeType", mime);
+
   display_name = g_file_info_get_display_name (info);
-  gom_tracker_sparql_connection_insert_or_replace_triple
-    (connection,
-     cancellable, error,
-     datasource_urn, resource,
-     "nfo:fileName", display_name);
+  append_property (update, "nfo:fileName", display_name);
 
-  if (*error != NULL)
-    goto out;
+  g_string_append (update, " . ");
 
  out:
-  if (checksum != NULL)
-    g_checksum_free (checksum);
+  g_free (guessed_mime);
+  g_free (guessed_type);
   g_free (identifier);
   g_free (resource);
   g_free (uri);
@@ -213,266 +262,1696 @@ account_miner_job_process_file (GomAccountMinerJob *job,
   return TRUE;
 }
 
-static void
-account_miner_job_traverse_dir (GomAccountMinerJob *job,
-                                TrackerSparqlConnection *connection,
-                                GHashTable *previous_resources,
+static gboolean
+account_miner_job_flush_update (TrackerSparqlConnection *connection,
                                 const gchar *datasource_urn,
-                                GFile *dir,
-                                gboolean is_root,
+                                GString *update,
                                 GCancellable *cancellable,
                                 GError **error)
 {
-  GError *local_error = NULL;
-  GFileEnumerator *enumerator;
-  GFileInfo *info;
-  gchar *dir_uri;
-
-  dir_uri = g_file_get_uri (dir);
-  enumerator = g_file_enumerate_children (dir,
-                                          FILE_ATTRIBUTES,
-                                          G_FILE_QUERY_INFO_NONE,
-                                          cancellable,
-                                          &local_error);
-  if (local_error != NULL)
-    goto out;
+  gchar *insert;
 
-  while ((info = g_file_enumerator_next_file (enumerator, cancellable, &local_error)) != NULL)
-    {
-      GFile *child;
-      GFileType type;
-      const gchar *name;
-      gchar *uri;
+  if (update->len == 0)
+    return TRUE;
 
-      type = g_file_info_get_file_type (info);
-      name = g_file_info_get_name (info);
-      child = g_file_get_child (dir, name);
+  insert = g_strdup_printf ("INSERT OR REPLACE INTO <%s> { %s }", datasource_urn, update->str);
+  gom_tracker_sparql_connection_update (connection, insert, G_PRIORITY_DEFAULT, cancellable, error);
+  g_free (insert);
 
-      if (type == G_FILE_TYPE_REGULAR || type == G_FILE_TYPE_DIRECTORY)
-        {
-          account_miner_job_process_file (job,
-                                          connection,
-                                          previous_resources,
-                                          datasource_urn,
-                                          child,
-                                          info,
-                                          is_root ? NULL : dir,
-                                          cancellable,
-                                          &local_error);
-          if (local_error != NULL)
-            {
-              uri = g_file_get_uri (child);
-              g_warning ("Unable to process %s: %s", uri, local_error->message);
-              g_free (uri);
-              g_clear_error (&local_error);
-            }
-        }
+  g_string_truncate (update, 0);
+  return (*error == NULL);
+}
 
-      if (type == G_FILE_TYPE_DIRECTORY)
-        {
-          account_miner_job_traverse_dir (job,
-                                          connection,
-                                          previous_resources,
-                                          datasource_urn,
-                                          child,
-                                          FALSE,
-                                          cancellable,
-                                          &local_error);
-          if (local_error != NULL)
-            {
-              uri = g_file_get_uri (child);
-              g_warning ("Unable to traverse %s: %s", uri, local_error->message);
-              g_free (uri);
-              g_clear_error (&local_error);
-            }
-        }
+/* A directory whose listing, or whose sub-tree, is still being worked
+ * on. Its tag is only stored once all of it was written successfully,
+ * so that an interrupted refresh doesn't prune it the next time.
+ */
+typedef struct _DirNode DirNode;
+
+struct _DirNode {
+  DirNode *parent;
+  gboolean failed;
+  gchar *identifier;
+  gchar *resource_urn;
+  gchar *tag;
+  volatile gint pending;
+};
 
-      g_object_unref (child);
-      g_object_unref (info);
-    }
+typedef struct {
+  DirNode *node;
+  GFile *dir;
+  GList *infos;
+  GList *pruned;
+  GError *error;
+  gboolean is_root;
+  gboolean last;
+} DirListing;
 
-  if (local_error != NULL)
-    goto out;
+typedef struct {
+  GomAccountMinerJob *job;
+  GCancellable *cancellable;
+  GAsyncQueue *listings;
+  GFile *root;
+  GHashTable *tags;
+  GPtrArray *urls;
+  GThreadPool *pool;
+  SoupSession *session;
+  TrackerSparqlConnection *connection;
+  const gchar *attributes;
+  const gchar *datasource_urn;
+  gboolean complete;
+  volatile gint n_pending;
+} Traversal;
+
+/* pending counts the node's own listing, plus one if the node is held
+ * until its parent's listing has been written
+ */
+static DirNode *
+dir_node_new (DirNode *parent, const gchar *identifier, const gchar *tag, gint pending)
+{
+  DirNode *node;
 
- out:
-  if (local_error != NULL)
-    g_propagate_error (error, local_error);
+  node = g_slice_new0 (DirNode);
+  node->parent = parent;
+  node->identifier = g_strdup (identifier);
+  node->tag = g_strdup (tag);
+  node->pending = pending;
 
-  g_clear_object (&enumerator);
-  g_free (dir_uri);
+  if (parent != NULL)
+    g_atomic_int_inc (&parent->pending);
+
+  return node;
 }
 
-static gboolean
-is_matching_volume (GVolume *volume, GoaObject *object)
+static void
+dir_node_free (DirNode *node)
 {
-  GoaAccount *account;
-  GoaFiles *files;
-  gboolean retval = FALSE;
-  const gchar *presentation_identity;
-  const gchar *uri;
-  gchar *name;
-  gchar *uuid;
+  g_free (node->identifier);
+  g_free (node->resource_urn);
+  g_free (node->tag);
+  g_slice_free (DirNode, node);
+}
 
-  account = goa_object_peek_account (object);
-  presentation_identity = goa_account_get_presentation_identity (account);
+static DirListing *
+dir_listing_new (GFile *dir, DirNode *node, gboolean is_root)
+{
+  DirListing *listing;
 
-  files = goa_object_peek_files (object);
-  uri = goa_files_get_uri (files);
+  listing = g_slice_new0 (DirListing);
+  listing->dir = dir;
+  listing->node = node;
+  listing->is_root = is_root;
+  return listing;
+}
 
-  name = g_volume_get_name (volume);
-  uuid = g_volume_get_uuid (volume);
+static void
+dir_listing_free (DirListing *listing)
+{
+  g_object_unref (listing->dir);
+  g_list_free_full (listing->infos, g_object_unref);
+  g_list_free_full (listing->pruned, g_object_unref);
+  g_clear_error (&listing->error);
+  g_slice_free (DirListing, listing);
+}
 
-  if (g_strcmp0 (name, presentation_identity) == 0 && g_strcmp0 (uuid, uri) == 0)
-    retval = TRUE;
+static gchar *
+get_dir_identifier (GFile *dir)
+{
+  gchar *identifier;
+  gchar *uri;
 
-  g_free (name);
-  g_free (uuid);
-  return retval;
+  uri = g_file_get_uri (dir);
+  identifier = get_identifier (uri, TRUE);
+  g_free (uri);
+
+  return identifier;
 }
 
-static void
-volume_added_cb (GVolumeMonitor *monitor, GVolume *volume, gpointer user_data)
+/* the path, starting with a '/', that the include and exclude rules
+ * are matched against
+ */
+static gchar *
+get_file_path (GFile *root, GFile *file)
 {
-  SyncData *data = (SyncData *) user_data;
-  GoaObject *object;
+  gchar *path;
+  gchar *retval;
 
-  object = GOA_OBJECT (g_hash_table_lookup (data->job->services, "documents"));
-  if (!is_matching_volume (volume, object))
-    return;
+  path = g_file_get_relative_path (root, file);
+  retval = g_strconcat ("/", path, NULL);
+  g_free (path);
 
-  g_object_set_data_full (G_OBJECT (object), "volume", g_object_ref (volume), g_object_unref);
-  g_main_loop_quit (data->loop);
+  return retval;
 }
 
-static void
-volume_mount_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+/* ownCloud changes the ETag, and the mtime, of every directory above
+ * a change. The path rules are part of the tag, so that changing them
+ * lists everything again.
+ */
+static gchar *
+get_dir_tag (GomAccountMinerJob *job, GFileInfo *info)
 {
-  GVolume *volume = G_VOLUME (source_object);
-  SyncData *data = (SyncData *) user_data;
+  GTimeVal tv;
+  const gchar *etag;
+  const gchar *rules;
+
+  rules = (job->path_rules_checksum != NULL) ? job->path_rules_checksum : "";
 
-  g_volume_mount_finish (volume, res, data->error);
-  g_main_loop_quit (data->loop);
+  etag = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ETAG_VALUE);
+  if (etag != NULL)
+    return g_strconcat (etag, rules, NULL);
+
+  g_file_info_get_modification_time (info, &tv);
+  return g_strdup_printf ("%ld%s", tv.tv_sec, rules);
 }
 
-static void
-query_owncloud (GomAccountMinerJob *job,
-                TrackerSparqlConnection *connection,
-                GHashTable *previous_resources,
-                const gchar *datasource_urn,
-                GCancellable *cancellable,
-                GError **error)
+static GHashTable *
+account_miner_job_load_dir_tags (GomAccountMinerJob *job,
+                                 TrackerSparqlConnection *connection,
+                                 const gchar *datasource_urn,
+                                 GCancellable *cancellable,
+                                 GError **error)
 {
-  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (job->miner);
-  GomOwncloudMinerPrivate *priv = self->priv;
-  GoaObject *object;
-  GFile *root;
-  GList *l;
-  GList *volumes;
-  GMainContext *context;
-  GMount *mount;
-  GVolume *volume;
-  SyncData data;
-  gboolean found = FALSE;
+  GHashTable *tags;
+  TrackerSparqlCursor *cursor;
+  gchar *select;
 
-  object = GOA_OBJECT (g_hash_table_lookup (job->services, "documents"));
-  if (object == NULL)
+  tags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  /* a forced refresh lists everything again */
+  if (job->force)
+    return tags;
+
+  select = g_strdup_printf ("SELECT ?id ?tag WHERE { "
+                            "?urn a nfo:DataContainer ; nie:dataSource <%s> ; nao:identifier ?id ; nie:version ?tag "
+                            "}",
+                            datasource_urn);
+  cursor = tracker_sparql_connection_query (connection, select, cancellable, error);
+  g_free (select);
+
+  if (cursor == NULL)
+    return tags;
+
+  while (tracker_sparql_cursor_next (cursor, cancellable, error))
     {
-      /* FIXME: use proper #defines and enumerated types */
-      g_set_error (error,
-                   g_quark_from_static_string ("gom-error"),
-                   0,
-                   "Can not query without a service");
-      return;
+      g_hash_table_insert (tags,
+                           g_strdup (tracker_sparql_cursor_get_string (cursor, 0, NULL)),
+                           g_strdup (tracker_sparql_cursor_get_string (cursor, 1, NULL)));
     }
 
-  data.job = job;
-  volumes = g_volume_monitor_get_volumes (priv->monitor);
+  g_object_unref (cursor);
+  return tags;
+}
 
-  /* find the volume corresponding to this GoaObject */
-  for (l = volumes; l != NULL && !found; l = l->next)
-    {
-      GVolume *volume = G_VOLUME (l->data);
+typedef struct {
+  gchar *identifier;
+  gchar *url;
+} ResourceUrl;
 
-      if (is_matching_volume (volume, object))
-        {
-          g_object_set_data_full (G_OBJECT (object), "volume", g_object_ref (volume), g_object_unref);
-          found = TRUE;
-        }
-    }
+static void
+resource_url_free (ResourceUrl *resource_url)
+{
+  g_free (resource_url->identifier);
+  g_free (resource_url->url);
+  g_slice_free (ResourceUrl, resource_url);
+}
+
+static gint
+resource_url_compare (gconstpointer a, gconstpointer b)
+{
+  const ResourceUrl *resource_url_a = *(const ResourceUrl **) a;
+  const ResourceUrl *resource_url_b = *(const ResourceUrl **) b;
 
-  /* wait for GVfs to add the volume, if it hasn't already */
-  if (!found)
+  return strcmp (resource_url_a->url, resource_url_b->url);
+}
+
+/* all the URLs of the datasource, sorted, so that the resources below
+ * a directory are next to each other
+ */
+static GPtrArray *
+account_miner_job_load_urls (TrackerSparqlConnection *connection,
+                             const gchar *datasource_urn,
+                             GCancellable *cancellable,
+                             GError **error)
+{
+  GPtrArray *urls;
+  TrackerSparqlCursor *cursor;
+  gchar *select;
+
+  select = g_strdup_printf ("SELECT ?id ?url WHERE { "
+                            "?urn nie:dataSource <%s> ; nao:identifier ?id ; nie:url ?url "
+                            "}",
+                            datasource_urn);
+  cursor = tracker_sparql_connection_query (connection, select, cancellable, error);
+  g_free (select);
+
+  if (cursor == NULL)
+    return NULL;
+
+  urls = g_ptr_array_new_with_free_func ((GDestroyNotify) resource_url_free);
+
+  while (tracker_sparql_cursor_next (cursor, cancellable, error))
     {
-      context = g_main_context_get_thread_default ();
-      data.loop = g_main_loop_new (context, FALSE);
+      ResourceUrl *resource_url;
 
-      g_signal_connect (priv->monitor, "volume-added", G_CALLBACK (volume_added_cb), &data);
-      g_main_loop_run (data.loop);
-      g_main_loop_unref (data.loop);
+      resource_url = g_slice_new (ResourceUrl);
+      resource_url->identifier = g_strdup (tracker_sparql_cursor_get_string (cursor, 0, NULL));
+      resource_url->url = g_strdup (tracker_sparql_cursor_get_string (cursor, 1, NULL));
+      g_ptr_array_add (urls, resource_url);
     }
 
-  /* mount the volume if needed */
-  volume = G_VOLUME (g_object_get_data (G_OBJECT (object), "volume"));
-  mount = g_volume_get_mount (volume);
-  if (mount == NULL)
+  g_object_unref (cursor);
+
+  if (*error != NULL)
     {
-      data.error = error;
+      g_ptr_array_unref (urls);
+      return NULL;
+    }
 
-      context = g_main_context_new ();
-      g_main_context_push_thread_default (context);
-      data.loop = g_main_loop_new (context, FALSE);
+  g_ptr_array_sort (urls, resource_url_compare);
+  return urls;
+}
 
-      g_volume_mount (volume, G_MOUNT_MOUNT_NONE, NULL, cancellable, volume_mount_cb, &data);
-      g_main_loop_run (data.loop);
+static gboolean
+traversal_mark_subtree_seen (Traversal *traversal,
+                             GHashTable *previous_resources,
+                             GFile *dir)
+{
+  gchar *prefix;
+  gchar *uri;
+  guint high;
+  guint low;
 
-      g_main_loop_unref (data.loop);
-      g_main_context_pop_thread_default (context);
-      g_main_context_unref (context);
+  /* without the URLs, the sub-tree is listed after all */
+  if (traversal->urls == NULL)
+    return FALSE;
 
-      if (*error != NULL)
-        return;
+  uri = g_file_get_uri (dir);
+  prefix = g_str_has_suffix (uri, "/") ? g_strdup (uri) : g_strconcat (uri, "/", NULL);
 
-      mount = g_volume_get_mount (volume);
+  /* find the first URL that is not before the prefix */
+  low = 0;
+  high = traversal->urls->len;
+  while (low < high)
+    {
+      ResourceUrl *resource_url;
+      guint middle;
+
+      middle = low + (high - low) / 2;
+      resource_url = g_ptr_array_index (traversal->urls, middle);
+      if (strcmp (resource_url->url, prefix) < 0)
+        low = middle + 1;
+      else
+        high = middle;
     }
 
-  root = g_mount_get_root (mount);
-  account_miner_job_traverse_dir (job, connection, previous_resources, datasource_urn, root, TRUE, cancellable, error);
+  for (; low < traversal->urls->len; low++)
+    {
+      ResourceUrl *resource_url;
 
-  g_object_unref (root);
-  g_object_unref (mount);
-  g_list_free_full (volumes, g_object_unref);
+      resource_url = g_ptr_array_index (traversal->urls, low);
+      if (!g_str_has_prefix (resource_url->url, prefix))
+        break;
+
+      g_hash_table_remove (previous_resources, resource_url->identifier);
+    }
+
+  g_free (prefix);
+  g_free (uri);
+  return TRUE;
 }
 
-static GHashTable *
-create_services (GomMiner *self,
-                 GoaObject *object)
+static void
+traversal_release_dir_node (Traversal *traversal, DirNode *node)
 {
-  GHashTable *services;
+  while (node != NULL && g_atomic_int_dec_and_test (&node->pending))
+    {
+      DirNode *parent = node->parent;
 
-  services = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                    NULL, (GDestroyNotify) g_object_unref);
+      if (!node->failed && node->tag != NULL)
+        {
+          GError *error = NULL;
+          gchar *escaped;
+          gchar *insert;
+
+          escaped = tracker_sparql_escape_string (node->tag);
+          insert = g_strdup_printf ("INSERT OR REPLACE INTO <%s> { ?urn nie:version \"%s\" } "
+                                    "WHERE { ?urn nie:dataSource <%s> ; nao:identifier \"%s\" }",
+                                    traversal->datasource_urn,
+                                    escaped,
+                                    traversal->datasource_urn,
+                                    node->identifier);
+          gom_tracker_sparql_connection_update (traversal->connection,
+                                                insert,
+                                                G_PRIORITY_DEFAULT,
+                                                traversal->cancellable,
+                                                &error);
+          g_free (insert);
+          g_free (escaped);
+
+          if (error != NULL)
+            {
+              g_warning ("Unable to store the tag of %s: %s", node->identifier, error->message);
+              g_error_free (error);
+            }
+        }
 
-  if (gom_miner_supports_type (self, "documents"))
-    g_hash_table_insert (services, "documents", g_object_ref (object));
+      if (parent == NULL)
+        traversal->complete = !node->failed;
+      else if (node->failed)
+        parent->failed = TRUE;
 
-  return services;
+      dir_node_free (node);
+      node = parent;
+    }
 }
 
 static void
-gom_owncloud_miner_dispose (GObject *object)
+traversal_async_ready_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
-  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (object);
-
-  g_clear_object (&self->priv->monitor);
+  GAsyncResult **result = user_data;
 
-  G_OBJECT_CLASS (gom_owncloud_miner_parent_class)->dispose (object);
+  *result = g_object_ref (res);
 }
 
+/* Excluded entries are dropped before anything else looks at them,
+ * so their sub-trees are never listed and whatever was stored for
+ * them is left in previous_resources to be removed.
+ */
 static void
-gom_owncloud_miner_init (GomOwncloudMiner *self)
+traversal_filter_excluded (Traversal *traversal, DirListing *listing)
 {
-  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GOM_TYPE_OWNCLOUD_MINER, GomOwncloudMinerPrivate);
+  GList *l;
+  GList *next;
+
+  if (traversal->job->path_rules_checksum == NULL)
+    return;
+
+  for (l = listing->infos; l != NULL; l = next)
+    {
+      GFileInfo *info = G_FILE_INFO (l->data);
+      GFile *child;
+      gchar *path;
+
+      next = l->next;
+
+      child = g_file_get_child (listing->dir, g_file_info_get_name (info));
+      path = get_file_path (traversal->root, child);
+
+      if (gom_account_miner_job_is_path_excluded (traversal->job,
+                                                  path,
+                                                  g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY))
+        {
+          listing->infos = g_list_delete_link (listing->infos, l);
+          g_object_unref (info);
+        }
+
+      g_free (path);
+      g_object_unref (child);
+    }
+}
+
+/* A directory is pending from the moment it is queued until the last
+ * batch of its listing has been handed to the writer. Counting it
+ * before the push means that the counter can't drop to zero while the
+ * listing that queued it is still on its way.
+ */
+static void
+traversal_push_dir (Traversal *traversal, DirListing *listing)
+{
+  g_atomic_int_inc (&traversal->n_pending);
+  g_thread_pool_push (traversal->pool, listing, NULL);
+}
+
+static void
+traversal_queue_subdirs (Traversal *traversal, DirListing *listing)
+{
+  GList *l;
+
+  /* The sub-directories are listed right away by the other
+   * threads, without waiting for this batch to be written. Those
+   * that didn't change since they were last listed in full are
+   * left to the writer.
+   */
+  for (l = listing->infos; l != NULL; l = l->next)
+    {
+      GFileInfo *info = G_FILE_INFO (l->data);
+      DirNode *child_node;
+      GFile *child;
+      const gchar *old_tag;
+      gchar *identifier;
+      gchar *tag;
+
+      if (g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+        continue;
+
+      child = g_file_get_child (listing->dir, g_file_info_get_name (info));
+      identifier = get_dir_identifier (child);
+      tag = get_dir_tag (traversal->job, info);
+
+      old_tag = g_hash_table_lookup (traversal->tags, identifier);
+      if (g_strcmp0 (old_tag, tag) == 0)
+        {
+          listing->pruned = g_list_prepend (listing->pruned, child);
+        }
+      else
+        {
+          child_node = dir_node_new (listing->node, identifier, tag, 2);
+          g_object_set_data (G_OBJECT (info), "gom-dir-node", child_node);
+          traversal_push_dir (traversal, dir_listing_new (child, child_node, FALSE));
+        }
+
+      g_free (identifier);
+      g_free (tag);
+    }
+}
+
+static void
+traversal_list_dir_gvfs (Traversal *traversal, DirListing *listing)
+{
+  DirNode *node;
+  GAsyncResult *res = NULL;
+  GFile *dir;
+  GFileEnumerator *enumerator = NULL;
+  GMainContext *context;
+  gboolean is_root;
+
+  dir = g_object_ref (listing->dir);
+  node = listing->node;
+  is_root = listing->is_root;
+
+  /* The asynchronous variants let GVfs hand the children over in
+   * batches instead of one D-Bus call per child. Each thread iterates
+   * its own context to wait for them.
+   */
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  g_file_enumerate_children_async (dir,
+                                   traversal->attributes,
+                                   G_FILE_QUERY_INFO_NONE,
+                                   G_PRIORITY_DEFAULT,
+                                   traversal->cancellable,
+                                   traversal_async_ready_cb,
+                                   &res);
+  while (res == NULL)
+    g_main_context_iteration (context, TRUE);
+
+  enumerator = g_file_enumerate_children_finish (dir, res, &listing->error);
+  g_clear_object (&res);
+  g_atomic_int_inc (&traversal->job->n_requests);
+
+  if (enumerator == NULL)
+    {
+      listing->last = TRUE;
+      g_async_queue_push (traversal->listings, listing);
+      goto out;
+    }
+
+  /* each batch is handed to the writer as a separate listing */
+  while (TRUE)
+    {
+      g_file_enumerator_next_files_async (enumerator,
+                                          NEXT_FILES_BATCH,
+                                          G_PRIORITY_DEFAULT,
+                                          traversal->cancellable,
+                                          traversal_async_ready_cb,
+                                          &res);
+      while (res == NULL)
+        g_main_context_iteration (context, TRUE);
+
+      listing->infos = g_file_enumerator_next_files_finish (enumerator, res, &listing->error);
+      g_clear_object (&res);
+
+      /* an empty batch ends the enumeration, not an excluded one */
+      listing->last = (listing->infos == NULL);
+
+      traversal_filter_excluded (traversal, listing);
+      traversal_queue_subdirs (traversal, listing);
+
+      g_async_queue_push (traversal->listings, listing);
+
+      if (listing->last)
+        break;
+
+      listing = dir_listing_new (g_object_ref (dir), node, is_root);
+    }
+
+ out:
+  g_clear_object (&enumerator);
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+  g_object_unref (dir);
+}
+
+static void
+traversal_list_dir_webdav (Traversal *traversal, DirListing *listing)
+{
+  gchar *uri;
+
+  /* the whole directory comes in one response */
+  uri = g_file_get_uri (listing->dir);
+  listing->infos = gom_webdav_list_children (traversal->session, uri, traversal->cancellable, &listing->error);
+  g_atomic_int_inc (&traversal->job->n_requests);
+  g_free (uri);
+
+  traversal_filter_excluded (traversal, listing);
+  traversal_queue_subdirs (traversal, listing);
+
+  listing->last = TRUE;
+  g_async_queue_push (traversal->listings, listing);
+}
+
+static void
+traversal_thread_func (gpointer data,
+                       gpointer user_data)
+{
+  DirListing *listing = data;
+  Traversal *traversal = user_data;
+
+  if (traversal->session != NULL)
+    traversal_list_dir_webdav (traversal, listing);
+  else
+    traversal_list_dir_gvfs (traversal, listing);
+}
+
+static gint
+account_miner_job_get_traverse_concurrency (GomAccountMinerJob *job)
+{
+  gint retval;
+
+  retval = gom_account_miner_job_get_config_int (job, "traverse-concurrency", TRAVERSE_CONCURRENCY);
+  return MAX (retval, 1);
+}
+
+/* returns whether the whole tree was written */
+static gboolean
+account_miner_job_traverse_dir (GomAccountMinerJob *job,
+                                TrackerSparqlConnection *connection,
+                                GHashTable *previous_resources,
+                                const gchar *datasource_urn,
+                                GFile *root,
+                                SoupSession *session,
+                                GCancellable *cancellable,
+                                GError **error)
+{
+  GError *local_error = NULL;
+  GString *update;
+  Traversal traversal;
+  gint max_threads;
+
+  traversal.job = job;
+  traversal.cancellable = cancellable;
+  traversal.listings = g_async_queue_new ();
+  traversal.root = root;
+  traversal.session = session;
+  traversal.connection = connection;
+  traversal.datasource_urn = datasource_urn;
+  traversal.complete = FALSE;
+  traversal.n_pending = 0;
+
+  /* fast-content-type=true in ~/.config/gnome-online-miners/miners.conf */
+  if (gom_account_miner_job_get_config_boolean (job, "fast-content-type", FALSE))
+    traversal.attributes = FAST_FILE_ATTRIBUTES;
+  else
+    traversal.attributes = FILE_ATTRIBUTES;
+
+  update = g_string_new (NULL);
+
+  traversal.tags = account_miner_job_load_dir_tags (job, connection, datasource_urn, cancellable, &local_error);
+  if (local_error != NULL)
+    {
+      g_warning ("Unable to query the directory tags: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  /* nothing can be pruned without tags */
+  traversal.urls = NULL;
+  if (g_hash_table_size (traversal.tags) > 0)
+    {
+      traversal.urls = account_miner_job_load_urls (connection, datasource_urn, cancellable, &local_error);
+      if (local_error != NULL)
+        {
+          g_warning ("Unable to query the URLs: %s", local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+
+  /* Every directory costs a round trip to the server, so a pool of
+   * threads lists them in parallel, while only this thread writes to
+   * Tracker. The directories that are still pending tell when the
+   * whole tree has been seen.
+   */
+  max_threads = account_miner_job_get_traverse_concurrency (job);
+  traversal.pool = g_thread_pool_new (traversal_thread_func, &traversal, max_threads, FALSE, NULL);
+
+  traversal_push_dir (&traversal, dir_listing_new (g_object_ref (root), dir_node_new (NULL, NULL, NULL, 1), TRUE));
+
+  while (g_atomic_int_get (&traversal.n_pending) > 0)
+    {
+      DirListing *listing;
+      GList *children = NULL;
+      GList *l;
+
+      listing = g_async_queue_pop (traversal.listings);
+
+      if (listing->error != NULL)
+        {
+          listing->node->failed = TRUE;
+
+          if (listing->is_root)
+            {
+              g_propagate_error (error, listing->error);
+              listing->error = NULL;
+            }
+          else
+            {
+              gchar *uri;
+
+              uri = g_file_get_uri (listing->dir);
+              g_warning ("Unable to traverse %s: %s", uri, listing->error->message);
+              g_free (uri);
+            }
+        }
+
+      for (l = listing->infos; l != NULL; l = l->next)
+        {
+          GFileInfo *info = G_FILE_INFO (l->data);
+          DirNode *child_node;
+          GFile *child;
+          GFileType type;
+
+          type = g_file_info_get_file_type (info);
+          if (type != G_FILE_TYPE_REGULAR && type != G_FILE_TYPE_DIRECTORY)
+            continue;
+
+          child = g_file_get_child (listing->dir, g_file_info_get_name (info));
+          account_miner_job_process_file (job,
+                                          connection,
+                                          previous_resources,
+                                          datasource_urn,
+                                          child,
+                                          info,
+                                          listing->is_root ? NULL : listing->node->identifier,
+                                          &listing->node->resource_urn,
+                                          update,
+                                          cancellable,
+                                          &local_error);
+          g_atomic_int_inc (&job->n_entries);
+
+          child_node = g_object_get_data (G_OBJECT (info), "gom-dir-node");
+          if (child_node != NULL)
+            children = g_list_prepend (children, child_node);
+
+          if (local_error != NULL)
+            {
+              gchar *uri;
+
+              uri = g_file_get_uri (child);
+              g_warning ("Unable to process %s: %s", uri, local_error->message);
+              g_free (uri);
+              g_clear_error (&local_error);
+
+              listing->node->failed = TRUE;
+              if (child_node != NULL)
+                child_node->failed = TRUE;
+            }
+
+          g_object_unref (child);
+        }
+
+      if (!account_miner_job_flush_update (connection, datasource_urn, update, cancellable, &local_error))
+        {
+          gchar *uri;
+
+          uri = g_file_get_uri (listing->dir);
+          g_warning ("Unable to write the children of %s: %s", uri, local_error->message);
+          g_free (uri);
+          g_clear_error (&local_error);
+
+          listing->node->failed = TRUE;
+          for (l = children; l != NULL; l = l->next)
+            ((DirNode *) l->data)->failed = TRUE;
+        }
+
+      /* the resources of an unchanged sub-tree are still there, but if
+       * we can't find them, the sub-tree is listed after all
+       */
+      for (l = listing->pruned; l != NULL; l = l->next)
+        {
+          DirNode *child_node;
+          GFile *child = G_FILE (l->data);
+          gchar *identifier;
+
+          if (traversal_mark_subtree_seen (&traversal, previous_resources, child))
+            continue;
+
+          /* it was already written as part of this listing */
+          identifier = get_dir_identifier (child);
+          child_node = dir_node_new (listing->node, identifier, NULL, 1);
+          g_free (identifier);
+
+          traversal_push_dir (&traversal, dir_listing_new (g_object_ref (child), child_node, FALSE));
+        }
+
+      for (l = children; l != NULL; l = l->next)
+        traversal_release_dir_node (&traversal, l->data);
+
+      if (listing->last)
+        {
+          traversal_release_dir_node (&traversal, listing->node);
+          g_atomic_int_add (&traversal.n_pending, -1);
+        }
+
+      g_list_free (children);
+      dir_listing_free (listing);
+    }
+
+  g_thread_pool_free (traversal.pool, FALSE, TRUE);
+  g_async_queue_unref (traversal.listings);
+  g_hash_table_unref (traversal.tags);
+  if (traversal.urls != NULL)
+    g_ptr_array_unref (traversal.urls);
+  g_string_free (update, TRUE);
+
+  return traversal.complete;
+}
+
+static gboolean
+is_matching_volume (GVolume *volume, GoaObject *object)
+{
+  GoaAccount *account;
+  GoaFiles *files;
+  gboolean retval = FALSE;
+  const gchar *presentation_identity;
+  const gchar *uri;
+  gchar *name;
+  gchar *uuid;
+
+  account = goa_object_peek_account (object);
+  presentation_identity = goa_account_get_presentation_identity (account);
+
+  files = goa_object_peek_files (object);
+  uri = goa_files_get_uri (files);
+
+  name = g_volume_get_name (volume);
+  uuid = g_volume_get_uuid (volume);
+
+  if (g_strcmp0 (name, presentation_identity) == 0 && g_strcmp0 (uuid, uri) == 0)
+    retval = TRUE;
+
+  g_free (name);
+  g_free (uuid);
+  return retval;
+}
+
+static MountState *
+mount_state_new (GomOwncloudMiner *self, GoaObject *object)
+{
+  MountState *state;
+
+  state = g_slice_new0 (MountState);
+  state->self = self;
+  state->object = g_object_ref (object);
+  state->kind = MOUNT_STATE_IDLE;
+  state->ref_count = 1;
+  return state;
+}
+
+static MountState *
+mount_state_ref (MountState *state)
+{
+  g_atomic_int_inc (&state->ref_count);
+  return state;
+}
+
+static void
+mount_state_unref (MountState *state)
+{
+  if (!g_atomic_int_dec_and_test (&state->ref_count))
+    return;
+
+  /* mount_state_stop already removed the timeout and cancelled the
+   * pending mount, which hold no reference of their own
+   */
+  g_clear_object (&state->cancellable);
+  g_clear_object (&state->mount);
+  g_clear_object (&state->volume);
+  g_clear_error (&state->error);
+  g_object_unref (state->object);
+  g_slice_free (MountState, state);
+}
+
+/* the following run in the main context, where the volume monitor
+ * emits its signals
+ */
+
+static void
+mount_state_set_kind (MountState *state, MountStateKind kind, GMount *mount, GError *error)
+{
+  GomOwncloudMinerPrivate *priv = state->self->priv;
+
+  if (state->timeout_id != 0)
+    {
+      g_source_remove (state->timeout_id);
+      state->timeout_id = 0;
+    }
+
+  g_mutex_lock (&priv->mutex);
+
+  state->kind = kind;
+
+  g_clear_object (&state->mount);
+  if (mount != NULL)
+    state->mount = g_object_ref (mount);
+
+  g_clear_error (&state->error);
+  if (error != NULL)
+    state->error = g_error_copy (error);
+
+  g_cond_broadcast (&priv->cond);
+  g_mutex_unlock (&priv->mutex);
+}
+
+/* wakes up the refresh threads waiting for the volume, and keeps it
+ * from being mounted again
+ */
+static void
+mount_state_stop (MountState *state)
+{
+  GomOwncloudMinerPrivate *priv = state->self->priv;
+  GError *error = NULL;
+
+  g_mutex_lock (&priv->mutex);
+  state->removed = TRUE;
+  g_mutex_unlock (&priv->mutex);
+
+  if (state->cancellable != NULL)
+    {
+      g_cancellable_cancel (state->cancellable);
+      g_clear_object (&state->cancellable);
+    }
+
+  g_set_error (&error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "The account was removed");
+  mount_state_set_kind (state, MOUNT_STATE_FAILED, NULL, error);
+  g_error_free (error);
+}
+
+static void
+mount_state_release (MountState *state)
+{
+  mount_state_stop (state);
+  mount_state_unref (state);
+}
+
+static gboolean
+mount_state_timeout_cb (gpointer user_data)
+{
+  MountState *state = user_data;
+  GError *error = NULL;
+
+  state->timeout_id = 0;
+
+  if (state->kind == MOUNT_STATE_WAITING_FOR_VOLUME)
+    {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "GVfs did not add the volume in time");
+    }
+  else
+    {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "The volume was not mounted in time");
+      g_cancellable_cancel (state->cancellable);
+      g_clear_object (&state->cancellable);
+    }
+
+  mount_state_set_kind (state, MOUNT_STATE_FAILED, NULL, error);
+  g_error_free (error);
+
+  return G_SOURCE_REMOVE;
+}
+
+typedef struct {
+  GCancellable *cancellable;
+  MountState *state;
+} MountOp;
+
+static void
+mount_state_mount_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GError *error = NULL;
+  GMount *mount = NULL;
+  GVolume *volume = G_VOLUME (source_object);
+  MountOp *op = user_data;
+  MountState *state = op->state;
+
+  /* it timed out, and another attempt might have started since */
+  if (op->cancellable != state->cancellable)
+    goto out;
+
+  g_clear_object (&state->cancellable);
+
+  if (!g_volume_mount_finish (volume, res, &error)
+      && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_ALREADY_MOUNTED))
+    {
+      mount_state_set_kind (state, MOUNT_STATE_FAILED, NULL, error);
+      goto out;
+    }
+
+  mount = g_volume_get_mount (volume);
+  if (mount == NULL)
+    {
+      g_clear_error (&error);
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_NOT_MOUNTED, "The volume was mounted, but has no mount");
+      mount_state_set_kind (state, MOUNT_STATE_FAILED, NULL, error);
+      goto out;
+    }
+
+  mount_state_set_kind (state, MOUNT_STATE_MOUNTED, mount, NULL);
+
+ out:
+  g_clear_error (&error);
+  g_clear_object (&mount);
+
+  /* the miner is kept alive by the pending operation */
+  g_object_unref (state->self);
+  mount_state_unref (state);
+  g_object_unref (op->cancellable);
+  g_slice_free (MountOp, op);
+}
+
+static void
+mount_state_mount (MountState *state)
+{
+  GMount *mount;
+  MountOp *op;
+
+  mount = g_volume_get_mount (state->volume);
+  if (mount != NULL)
+    {
+      mount_state_set_kind (state, MOUNT_STATE_MOUNTED, mount, NULL);
+      g_object_unref (mount);
+      return;
+    }
+
+  mount_state_set_kind (state, MOUNT_STATE_MOUNTING, NULL, NULL);
+
+  state->cancellable = g_cancellable_new ();
+  state->timeout_id = g_timeout_add_seconds (MOUNT_TIMEOUT, mount_state_timeout_cb, state);
+
+  op = g_slice_new0 (MountOp);
+  op->cancellable = g_object_ref (state->cancellable);
+  op->state = mount_state_ref (state);
+
+  g_object_ref (state->self);
+  g_volume_mount (state->volume,
+                  G_MOUNT_MOUNT_NONE,
+                  NULL,
+                  op->cancellable,
+                  mount_state_mount_cb,
+                  op);
+}
+
+static void
+mount_state_start (MountState *state)
+{
+  GomOwncloudMinerPrivate *priv = state->self->priv;
+  GList *l;
+  GList *volumes;
+  GVolume *volume = NULL;
+  MountStateKind kind;
+  gboolean removed;
+
+  /* the refresh threads reset failed states */
+  g_mutex_lock (&priv->mutex);
+
+  kind = state->kind;
+  removed = state->removed;
+  if (state->volume != NULL)
+    volume = g_object_ref (state->volume);
+
+  g_mutex_unlock (&priv->mutex);
+
+  /* the account is gone */
+  if (removed)
+    goto out;
+
+  /* a mount that is still in progress will tell */
+  if (kind == MOUNT_STATE_WAITING_FOR_VOLUME || kind == MOUNT_STATE_MOUNTING)
+    goto out;
+
+  if (kind == MOUNT_STATE_MOUNTED)
+    {
+      GMount *mount;
+
+      /* still mounted? */
+      mount = g_volume_get_mount (volume);
+      if (mount != NULL)
+        {
+          g_object_unref (mount);
+          goto out;
+        }
+    }
+
+  if (volume == NULL)
+    {
+      volumes = g_volume_monitor_get_volumes (priv->monitor);
+      for (l = volumes; l != NULL && volume == NULL; l = l->next)
+        {
+          if (is_matching_volume (G_VOLUME (l->data), state->object))
+            volume = g_object_ref (l->data);
+        }
+
+      g_list_free_full (volumes, g_object_unref);
+
+      if (volume != NULL)
+        {
+          g_mutex_lock (&priv->mutex);
+          state->volume = g_object_ref (volume);
+          g_mutex_unlock (&priv->mutex);
+        }
+    }
+
+  /* volume_added_cb takes over once GVfs adds it */
+  if (volume == NULL)
+    {
+      mount_state_set_kind (state, MOUNT_STATE_WAITING_FOR_VOLUME, NULL, NULL);
+      state->timeout_id = g_timeout_add_seconds (VOLUME_TIMEOUT, mount_state_timeout_cb, state);
+      goto out;
+    }
+
+  mount_state_mount (state);
+
+ out:
+  g_clear_object (&volume);
+}
+
+static gboolean
+mount_state_start_cb (gpointer user_data)
+{
+  MountState *state = user_data;
+
+  mount_state_start (state);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+volume_added_cb (GVolumeMonitor *monitor, GVolume *volume, gpointer user_data)
+{
+  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (user_data);
+  GomOwncloudMinerPrivate *priv = self->priv;
+  GHashTableIter iter;
+  GList *l;
+  GList *states = NULL;
+  MountState *state;
+
+  /* the refresh threads add to the table */
+  g_mutex_lock (&priv->mutex);
+
+  g_hash_table_iter_init (&iter, priv->mounts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &state))
+    {
+      if (state->kind != MOUNT_STATE_WAITING_FOR_VOLUME || !is_matching_volume (volume, state->object))
+        continue;
+
+      state->volume = g_object_ref (volume);
+      states = g_list_prepend (states, mount_state_ref (state));
+    }
+
+  g_mutex_unlock (&priv->mutex);
+
+  /* mount_state_mount takes the mutex itself */
+  for (l = states; l != NULL; l = l->next)
+    mount_state_mount (l->data);
+
+  g_list_free_full (states, (GDestroyNotify) mount_state_unref);
+}
+
+static void
+account_removed_cb (GoaClient *client, GoaObject *object, gpointer user_data)
+{
+  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (user_data);
+  GomOwncloudMinerPrivate *priv = self->priv;
+  GoaAccount *account;
+  MountState *state = NULL;
+  gchar *account_id = NULL;
+
+  account = goa_object_peek_account (object);
+  if (account == NULL)
+    return;
+
+  g_mutex_lock (&priv->mutex);
+
+  if (g_hash_table_lookup_extended (priv->mounts,
+                                    goa_account_get_id (account),
+                                    (gpointer *) &account_id,
+                                    (gpointer *) &state))
+    g_hash_table_steal (priv->mounts, account_id);
+
+  g_mutex_unlock (&priv->mutex);
+
+  /* mount_state_stop takes the mutex itself */
+  if (state != NULL)
+    mount_state_release (state);
+
+  g_free (account_id);
+}
+
+static MountState *
+gom_owncloud_miner_lookup_mount_state (GomOwncloudMiner *self, GoaObject *object)
+{
+  GomOwncloudMinerPrivate *priv = self->priv;
+  MountState *state;
+  const gchar *account_id;
+
+  account_id = goa_account_get_id (goa_object_peek_account (object));
+
+  g_mutex_lock (&priv->mutex);
+
+  state = g_hash_table_lookup (priv->mounts, account_id);
+  if (state == NULL)
+    {
+      state = mount_state_new (self, object);
+      g_hash_table_insert (priv->mounts, g_strdup (account_id), state);
+    }
+
+  mount_state_ref (state);
+  g_mutex_unlock (&priv->mutex);
+
+  return state;
+}
+
+/* Volumes are mounted as soon as the miner starts, so that they are
+ * ready by the time a refresh comes in.
+ */
+static void
+setup (GomMiner *miner, GoaClient *client)
+{
+  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (miner);
+  GList *accounts;
+  GList *l;
+
+  g_signal_connect_object (client, "account-removed", G_CALLBACK (account_removed_cb), self, 0);
+
+  accounts = goa_client_get_accounts (client);
+  for (l = accounts; l != NULL; l = l->next)
+    {
+      GoaAccount *account;
+      GoaObject *object = GOA_OBJECT (l->data);
+      MountState *state;
+
+      account = goa_object_peek_account (object);
+      if (account == NULL || goa_object_peek_files (object) == NULL)
+        continue;
+
+      if (g_strcmp0 (goa_account_get_provider_type (account), "owncloud") != 0)
+        continue;
+
+      state = gom_owncloud_miner_lookup_mount_state (self, object);
+      mount_state_start (state);
+      mount_state_unref (state);
+    }
+
+  g_list_free_full (accounts, g_object_unref);
+}
+
+/* called from the refresh threads */
+static GMount *
+gom_owncloud_miner_wait_for_mount (GomOwncloudMiner *self,
+                                   GoaObject *object,
+                                   GCancellable *cancellable,
+                                   GError **error)
+{
+  GomOwncloudMinerPrivate *priv = self->priv;
+  GMount *retval = NULL;
+  MountState *state;
+  gint64 deadline;
+
+  state = gom_owncloud_miner_lookup_mount_state (self, object);
+
+  /* a failed attempt is retried by the next refresh, unless the account
+   * was removed meanwhile
+   */
+  g_mutex_lock (&priv->mutex);
+  if (state->kind == MOUNT_STATE_FAILED && !state->removed)
+    state->kind = MOUNT_STATE_IDLE;
+  g_mutex_unlock (&priv->mutex);
+
+  g_main_context_invoke_full (priv->context,
+                              G_PRIORITY_DEFAULT,
+                              mount_state_start_cb,
+                              mount_state_ref (state),
+                              (GDestroyNotify) mount_state_unref);
+
+  /* the main context gives up on its own, but don't count on it */
+  deadline = g_get_monotonic_time () + (VOLUME_TIMEOUT + MOUNT_TIMEOUT + 1) * G_TIME_SPAN_SECOND;
+
+  g_mutex_lock (&priv->mutex);
+
+  while (state->kind != MOUNT_STATE_MOUNTED && state->kind != MOUNT_STATE_FAILED)
+    {
+      gint64 now;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      now = g_get_monotonic_time ();
+      if (now >= deadline)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "The volume was not mounted in time");
+          goto out;
+        }
+
+      /* wake up now and then to notice cancellation */
+      g_cond_wait_until (&priv->cond, &priv->mutex, MIN (deadline, now + G_TIME_SPAN_SECOND));
+    }
+
+  if (state->kind == MOUNT_STATE_FAILED)
+    {
+      g_propagate_error (error, g_error_copy (state->error));
+      goto out;
+    }
+
+  retval = g_object_ref (state->mount);
+
+ out:
+  g_mutex_unlock (&priv->mutex);
+  mount_state_unref (state);
+  return retval;
+}
+
+static gboolean
+account_miner_job_delete_file (TrackerSparqlConnection *connection,
+                               const gchar *datasource_urn,
+                               GFile *file,
+                               GCancellable *cancellable,
+                               GError **error)
+{
+  gchar *delete;
+  gchar *dir_identifier;
+  gchar *escaped;
+  gchar *identifier;
+  gchar *prefix;
+  gchar *uri;
+
+  uri = g_file_get_uri (file);
+  identifier = get_identifier (uri, FALSE);
+  dir_identifier = get_identifier (uri, TRUE);
+  prefix = g_str_has_suffix (uri, "/") ? g_strdup (uri) : g_strconcat (uri, "/", NULL);
+  escaped = tracker_sparql_escape_string (prefix);
+
+  /* we don't know whether it was a directory, so anything that was
+   * below it goes too
+   */
+  delete = g_strdup_printf ("DELETE { ?urn a rdfs:Resource } WHERE { "
+                            "?urn nie:dataSource <%s> ; nao:identifier ?id . "
+                            "OPTIONAL { ?urn nie:url ?url } "
+                            "FILTER (?id IN (\"%s\", \"%s\") || STRSTARTS (?url, \"%s\")) "
+                            "}",
+                            datasource_urn, identifier, dir_identifier, escaped);
+  gom_tracker_sparql_connection_update (connection, delete, G_PRIORITY_DEFAULT, cancellable, error);
+
+  g_free (delete);
+  g_free (escaped);
+  g_free (prefix);
+  g_free (dir_identifier);
+  g_free (identifier);
+  g_free (uri);
+
+  return (*error == NULL);
+}
+
+/* The path rules are stored along with the token, because the
+ * changes since it don't cover what the new rules include or exclude.
+ * Tokens from the server never contain a space.
+ */
+static gchar *
+account_miner_job_dup_sync_token (GomAccountMinerJob *job, GError **error)
+{
+  gchar *retval = NULL;
+  gchar *token;
+
+  token = gom_account_miner_job_dup_sync_token (job, "documents", error);
+  if (token == NULL)
+    goto out;
+
+  if (job->path_rules_checksum == NULL)
+    {
+      if (strchr (token, ' ') == NULL)
+        retval = g_strdup (token);
+    }
+  else
+    {
+      gsize len;
+
+      len = strlen (job->path_rules_checksum);
+      if (strncmp (token, job->path_rules_checksum, len) == 0 && token[len] == ' ')
+        retval = g_strdup (token + len + 1);
+    }
+
+ out:
+  g_free (token);
+  return retval;
+}
+
+static void
+account_miner_job_store_sync_token (GomAccountMinerJob *job, const gchar *sync_token)
+{
+  GError *error = NULL;
+  gchar *token = NULL;
+
+  if (sync_token != NULL && job->path_rules_checksum != NULL)
+    token = g_strconcat (job->path_rules_checksum, " ", sync_token, NULL);
+  else
+    token = g_strdup (sync_token);
+
+  gom_account_miner_job_set_sync_token (job, "documents", token, &error);
+  if (error != NULL)
+    {
+      g_warning ("Unable to store the sync token: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (token);
+}
+
+/* returns FALSE if the changes could not be fetched at all */
+static gboolean
+account_miner_job_sync_changes (GomAccountMinerJob *job,
+                                TrackerSparqlConnection *connection,
+                                GHashTable *previous_resources,
+                                const gchar *datasource_urn,
+                                SoupSession *session,
+                                GFile *root,
+                                const gchar *sync_token,
+                                GCancellable *cancellable,
+                                GError **error)
+{
+  GError *local_error = NULL;
+  GHashTable *parents;
+  GList *changes;
+  GList *l;
+  GString *update;
+  gboolean failed = FALSE;
+  gchar *new_sync_token = NULL;
+  gchar *root_uri;
+
+  root_uri = g_file_get_uri (root);
+  changes = gom_webdav_sync_collection (session, root_uri, sync_token, &new_sync_token, cancellable, error);
+  g_atomic_int_inc (&job->n_requests);
+  g_free (root_uri);
+
+  if (*error != NULL)
+    return FALSE;
+
+  update = g_string_new (NULL);
+  parents = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  for (l = changes; l != NULL; l = l->next)
+    {
+      GomWebdavChange *change = l->data;
+      GFile *child;
+      gchar *path;
+
+      child = g_file_resolve_relative_path (root, change->path);
+      path = get_file_path (root, child);
+
+      /* whatever is excluded goes away as if it was removed */
+      if (change->info == NULL
+          || gom_account_miner_job_is_path_excluded (job,
+                                                     path,
+                                                     g_file_info_get_file_type (change->info) == G_FILE_TYPE_DIRECTORY))
+        {
+          account_miner_job_delete_file (connection, datasource_urn, child, cancellable, &local_error);
+        }
+      else
+        {
+          GFile *parent;
+          gchar *parent_identifier = NULL;
+          gchar *parent_resource_urn = NULL;
+
+          parent = g_file_get_parent (child);
+          if (parent != NULL && !g_file_equal (parent, root))
+            {
+              parent_identifier = get_dir_identifier (parent);
+              parent_resource_urn = g_strdup (g_hash_table_lookup (parents, parent_identifier));
+            }
+
+          account_miner_job_process_file (job,
+                                          connection,
+                                          previous_resources,
+                                          datasource_urn,
+                                          child,
+                                          change->info,
+                                          parent_identifier,
+                                          &parent_resource_urn,
+                                          update,
+                                          cancellable,
+                                          &local_error);
+          g_atomic_int_inc (&job->n_entries);
+
+          if (parent_resource_urn != NULL)
+            g_hash_table_insert (parents, parent_identifier, parent_resource_urn);
+          else
+            g_free (parent_identifier);
+
+          g_clear_object (&parent);
+        }
+
+      if (local_error != NULL)
+        {
+          g_warning ("Unable to process %s: %s", change->path, local_error->message);
+          g_clear_error (&local_error);
+          failed = TRUE;
+        }
+
+      g_object_unref (child);
+      g_free (path);
+    }
+
+  if (!account_miner_job_flush_update (connection, datasource_urn, update, cancellable, &local_error))
+    {
+      g_warning ("Unable to write the changes: %s", local_error->message);
+      g_clear_error (&local_error);
+      failed = TRUE;
+    }
+
+  /* the same changes are asked for again the next time */
+  if (!failed)
+    account_miner_job_store_sync_token (job, new_sync_token);
+
+  /* everything that was not removed is still there */
+  g_hash_table_remove_all (previous_resources);
+
+  g_list_free_full (changes, (GDestroyNotify) gom_webdav_change_free);
+  g_hash_table_unref (parents);
+  g_string_free (update, TRUE);
+  g_free (new_sync_token);
+  return TRUE;
+}
+
+static void
+query_owncloud_webdav (GomAccountMinerJob *job,
+                       TrackerSparqlConnection *connection,
+                       GHashTable *previous_resources,
+                       const gchar *datasource_urn,
+                       GoaObject *object,
+                       GCancellable *cancellable,
+                       GError **error)
+{
+  GError *local_error = NULL;
+  GoaAccount *account;
+  GoaFiles *files;
+  GoaPasswordBased *password_based;
+  GFile *root;
+  SoupSession *session;
+  gchar *password = NULL;
+  gchar *sync_token = NULL;
+
+  account = goa_object_peek_account (object);
+  files = goa_object_peek_files (object);
+  password_based = goa_object_peek_password_based (object);
+  if (password_based == NULL)
+    {
+      /* FIXME: use proper #defines and enumerated types */
+      g_set_error (error,
+                   g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Can not talk to WebDAV without a password");
+      return;
+    }
+
+  if (!goa_password_based_call_get_password_sync (password_based, "", &password, cancellable, error))
+    return;
+
+  session = gom_webdav_session_new (goa_account_get_identity (account),
+                                    password,
+                                    account_miner_job_get_traverse_concurrency (job));
+  root = g_file_new_for_uri (goa_files_get_uri (files));
+
+  /* only ask for what changed since the last refresh, if possible */
+  if (!job->force)
+    {
+      sync_token = account_miner_job_dup_sync_token (job, &local_error);
+      if (local_error != NULL)
+        {
+          g_warning ("Unable to query the sync token: %s", local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+
+  if (sync_token != NULL)
+    {
+      if (account_miner_job_sync_changes (job,
+                                          connection,
+                                          previous_resources,
+                                          datasource_urn,
+                                          session,
+                                          root,
+                                          sync_token,
+                                          cancellable,
+                                          &local_error))
+        goto out;
+
+      if (g_cancellable_is_cancelled (cancellable))
+        {
+          g_propagate_error (error, local_error);
+          goto out;
+        }
+
+      g_debug ("Unable to sync the changes, listing everything: %s", local_error->message);
+      g_clear_error (&local_error);
+      g_clear_pointer (&sync_token, g_free);
+    }
+
+  /* the token comes first so that nothing that changes during the
+   * traversal is missed
+   */
+  sync_token = gom_webdav_get_sync_token (session, goa_files_get_uri (files), cancellable, &local_error);
+  if (local_error != NULL)
+    {
+      g_debug ("Unable to get a sync token: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  /* a tree that was not completely written can't be synced from */
+  if (!account_miner_job_traverse_dir (job,
+                                       connection,
+                                       previous_resources,
+                                       datasource_urn,
+                                       root,
+                                       session,
+                                       cancellable,
+                                       error))
+    g_clear_pointer (&sync_token, g_free);
+
+  if (*error != NULL)
+    goto out;
+
+  account_miner_job_store_sync_token (job, sync_token);
+
+ out:
+  g_object_unref (root);
+  g_object_unref (session);
+  g_free (password);
+  g_free (sync_token);
+}
+
+static void
+query_owncloud (GomAccountMinerJob *job,
+                TrackerSparqlConnection *connection,
+                GHashTable *previous_resources,
+                const gchar *datasource_urn,
+                GCancellable *cancellable,
+                GError **error)
+{
+  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (job->miner);
+  GoaObject *object;
+  GFile *root;
+  GMount *mount;
+  gchar *backend;
+
+  object = GOA_OBJECT (g_hash_table_lookup (job->services, "documents"));
+  if (object == NULL)
+    {
+      /* FIXME: use proper #defines and enumerated types */
+      g_set_error (error,
+                   g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Can not query without a service");
+      return;
+    }
+
+  /* talk to the server directly instead of going through GVfs */
+  backend = gom_account_miner_job_dup_config_string (job, "backend", "gvfs");
+  if (g_strcmp0 (backend, "webdav") == 0)
+    {
+      query_owncloud_webdav (job, connection, previous_resources, datasource_urn, object, cancellable, error);
+      g_free (backend);
+      return;
+    }
+
+  g_free (backend);
+
+  mount = gom_owncloud_miner_wait_for_mount (self, object, cancellable, error);
+  if (mount == NULL)
+    return;
+
+  root = g_mount_get_root (mount);
+  account_miner_job_traverse_dir (job, connection, previous_resources, datasource_urn, root, NULL, cancellable, error);
+
+  g_object_unref (root);
+  g_object_unref (mount);
+}
+
+static GHashTable *
+create_services (GomMiner *self,
+                 GoaObject *object,
+                 const gchar **index_types)
+{
+  GHashTable *services;
+
+  services = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                    NULL, (GDestroyNotify) g_object_unref);
+
+  if (gom_miner_supports_type (index_types, "documents"))
+    g_hash_table_insert (services, "documents", g_object_ref (object));
+
+  return services;
+}
+
+static void
+gom_owncloud_miner_dispose (GObject *object)
+{
+  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (object);
+
+  g_clear_pointer (&self->priv->mounts, g_hash_table_unref);
+  g_clear_object (&self->priv->monitor);
+  g_clear_pointer (&self->priv->context, g_main_context_unref);
+
+  G_OBJECT_CLASS (gom_owncloud_miner_parent_class)->dispose (object);
+}
+
+static void
+gom_owncloud_miner_finalize (GObject *object)
+{
+  GomOwncloudMiner *self = GOM_OWNCLOUD_MINER (object);
+
+  g_cond_clear (&self->priv->cond);
+  g_mutex_clear (&self->priv->mutex);
+
+  G_OBJECT_CLASS (gom_owncloud_miner_parent_class)->finalize (object);
+}
+
+static void
+gom_owncloud_miner_init (GomOwncloudMiner *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GOM_TYPE_OWNCLOUD_MINER, GomOwncloudMinerPrivate);
+
+  g_cond_init (&self->priv->cond);
+  g_mutex_init (&self->priv->mutex);
+
+  self->priv->context = g_main_context_ref_thread_default ();
+  self->priv->mounts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) mount_state_release);
   self->priv->monitor = g_volume_monitor_get ();
+  g_signal_connect_object (self->priv->monitor, "volume-added", G_CALLBACK (volume_added_cb), self, 0);
 }
 
 static void
@@ -482,13 +1961,15 @@ gom_owncloud_miner_class_init (GomOwncloudMinerClass *klass)
   GomMinerClass *miner_class = GOM_MINER_CLASS (klass);
 
   oclass->dispose = gom_owncloud_miner_dispose;
+  oclass->finalize = gom_owncloud_miner_finalize;
 
   miner_class->goa_provider_type = "owncloud";
   miner_class->miner_identifier = MINER_IDENTIFIER;
-  miner_class->version = 1;
+  miner_class->version = 2;
 
   miner_class->create_services = create_services;
   miner_class->query = query_owncloud;
+  miner_class->setup = setup;
 
   g_type_class_add_private (klass, sizeof (GomOwncloudMinerPrivate));
 }
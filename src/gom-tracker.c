@@ -26,6 +26,47 @@
 #include "gom-tracker.h"
 #include "gom-utils.h"
 
+/* the counter of the refresh that runs in this thread, if any */
+static GPrivate update_counter;
+
+void
+gom_tracker_set_update_counter (volatile gint *counter)
+{
+  g_private_set (&update_counter, (gpointer) counter);
+}
+
+static void
+gom_tracker_count_update (void)
+{
+  volatile gint *counter;
+
+  counter = g_private_get (&update_counter);
+  if (counter != NULL)
+    g_atomic_int_inc (counter);
+}
+
+void
+gom_tracker_sparql_connection_update (TrackerSparqlConnection *connection,
+                                      const gchar *sparql,
+                                      gint priority,
+                                      GCancellable *cancellable,
+                                      GError **error)
+{
+  gom_tracker_count_update ();
+  tracker_sparql_connection_update (connection, sparql, priority, cancellable, error);
+}
+
+GVariant *
+gom_tracker_sparql_connection_update_blank (TrackerSparqlConnection *connection,
+                                            const gchar *sparql,
+                                            gint priority,
+                                            GCancellable *cancellable,
+                                            GError **error)
+{
+  gom_tracker_count_update ();
+  return tracker_sparql_connection_update_blank (connection, sparql, priority, cancellable, error);
+}
+
 static gchar *
 _tracker_utils_format_into_graph (const gchar *graph)
 {
@@ -147,8 +188,8 @@ gom_tracker_sparql_connection_ensure_resource (TrackerSparqlConnection *connecti
   g_string_free (inner, TRUE);
 
   insert_res =
-    tracker_sparql_connection_update_blank (connection, insert->str,
-                                            G_PRIORITY_DEFAULT, NULL, error);
+    gom_tracker_sparql_connection_update_blank (connection, insert->str,
+                                                G_PRIORITY_DEFAULT, NULL, error);
 
   g_string_free (insert, TRUE);
 
@@ -214,9 +255,9 @@ gom_tracker_sparql_connection_insert_or_replace_triple (TrackerSparqlConnection
 
   g_debug ("Insert or replace triple: query %s", insert->str);
 
-  tracker_sparql_connection_update (connection, insert->str,
-                                    G_PRIORITY_DEFAULT, cancellable,
-                                    error);
+  gom_tracker_sparql_connection_update (connection, insert->str,
+                                        G_PRIORITY_DEFAULT, cancellable,
+                                        error);
 
   g_string_free (insert, TRUE);
 
@@ -246,9 +287,9 @@ gom_tracker_sparql_connection_set_triple (TrackerSparqlConnection *connection,
      "DELETE { <%s> %s ?val } WHERE { <%s> %s ?val }", resource,
      property_name, resource, property_name);
 
-  tracker_sparql_connection_update (connection, delete->str,
-                                    G_PRIORITY_DEFAULT, cancellable,
-                                    error);
+  gom_tracker_sparql_connection_update (connection, delete->str,
+                                        G_PRIORITY_DEFAULT, cancellable,
+                                        error);
 
   g_string_free (delete, TRUE);
   if (*error != NULL)
@@ -267,6 +308,36 @@ gom_tracker_sparql_connection_set_triple (TrackerSparqlConnection *connection,
   return retval;
 }
 
+gboolean
+gom_tracker_sparql_connection_delete_resource (TrackerSparqlConnection *connection,
+                                               GCancellable *cancellable,
+                                               GError **error,
+                                               const gchar *datasource_urn,
+                                               const gchar *identifier)
+{
+  GString *delete;
+  gboolean retval = TRUE;
+
+  delete = g_string_new (NULL);
+  g_string_append_printf
+    (delete,
+     "DELETE { ?urn a rdfs:Resource } WHERE { ?urn nie:dataSource <%s> ; nao:identifier \"%s\" }",
+     datasource_urn, identifier);
+
+  g_debug ("Delete resource: query %s", delete->str);
+
+  gom_tracker_sparql_connection_update (connection, delete->str,
+                                        G_PRIORITY_DEFAULT, cancellable,
+                                        error);
+
+  g_string_free (delete, TRUE);
+
+  if (*error != NULL)
+    retval = FALSE;
+
+  return retval;
+}
+
 gboolean
 gom_tracker_sparql_connection_toggle_favorite (TrackerSparqlConnection *connection,
                                                GCancellable *cancellable,
@@ -291,9 +362,9 @@ gom_tracker_sparql_connection_toggle_favorite (TrackerSparqlConnection *connecti
 
   g_debug ("Toggle favorite: query %s", update->str);
 
-  tracker_sparql_connection_update (connection, update->str,
-                                    G_PRIORITY_DEFAULT, cancellable,
-                                    error);
+  gom_tracker_sparql_connection_update (connection, update->str,
+                                        G_PRIORITY_DEFAULT, cancellable,
+                                        error);
 
   g_string_free (update, TRUE);
 
@@ -357,8 +428,8 @@ gom_tracker_utils_ensure_contact_resource (TrackerSparqlConnection *connection,
                           mail_uri, fullname);
 
   insert_res =
-    tracker_sparql_connection_update_blank (connection, insert->str,
-                                            G_PRIORITY_DEFAULT, cancellable, error);
+    gom_tracker_sparql_connection_update_blank (connection, insert->str,
+                                                G_PRIORITY_DEFAULT, cancellable, error);
 
   g_string_free (insert, TRUE);
 
@@ -455,7 +526,7 @@ gom_tracker_utils_ensure_equipment_resource (TrackerSparqlConnection *connection
                             model);
 
   local_error = NULL;
-  tracker_sparql_connection_update (connection, insert, G_PRIORITY_DEFAULT, cancellable, &local_error);
+  gom_tracker_sparql_connection_update (connection, insert, G_PRIORITY_DEFAULT, cancellable, &local_error);
   if (local_error != NULL)
     {
       g_propagate_error (error, local_error);
@@ -518,6 +589,38 @@ gom_tracker_update_datasource (TrackerSparqlConnection  *connection,
        "nie:dataSource", datasource_urn);
 }
 
+/* like gom_tracker_update_mtime, for callers that write the new
+ * mtime together with the other properties
+ */
+gboolean
+gom_tracker_mtime_changed (TrackerSparqlConnection  *connection,
+                           gint64                    new_mtime,
+                           gboolean                  resource_exists,
+                           const gchar              *resource,
+                           GCancellable             *cancellable,
+                           GError                  **error)
+{
+  GTimeVal old_mtime;
+  gboolean res;
+  gchar *old_value;
+
+  if (!resource_exists)
+    return TRUE;
+
+  res = gom_tracker_sparql_connection_get_string_attribute
+    (connection, cancellable, error,
+     resource, "nie:contentLastModified", &old_value);
+  g_clear_error (error);
+
+  if (res)
+    {
+      res = g_time_val_from_iso8601 (old_value, &old_mtime);
+      g_free (old_value);
+    }
+
+  return !(res && (new_mtime == old_mtime.tv_sec));
+}
+
 gboolean
 gom_tracker_update_mtime (TrackerSparqlConnection  *connection,
                           gint64                    new_mtime,
@@ -527,27 +630,10 @@ gom_tracker_update_mtime (TrackerSparqlConnection  *connection,
                           GCancellable             *cancellable,
                           GError                  **error)
 {
-  GTimeVal old_mtime;
-  gboolean res;
-  gchar *old_value;
   gchar *date;
 
-  if (resource_exists)
-    {
-      res = gom_tracker_sparql_connection_get_string_attribute
-        (connection, cancellable, error,
-         resource, "nie:contentLastModified", &old_value);
-      g_clear_error (error);
-
-      if (res)
-        {
-          res = g_time_val_from_iso8601 (old_value, &old_mtime);
-          g_free (old_value);
-        }
-
-      if (res && (new_mtime == old_mtime.tv_sec))
-        return FALSE;
-    }
+  if (!gom_tracker_mtime_changed (connection, new_mtime, resource_exists, resource, cancellable, error))
+    return FALSE;
 
   date = gom_iso8601_from_timestamp (new_mtime);
   gom_tracker_sparql_connection_insert_or_replace_triple
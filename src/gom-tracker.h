@@ -29,6 +29,23 @@
 
 G_BEGIN_DECLS
 
+/* Every update goes through these, so that they can be counted. The
+ * updates made by a thread go to the counter it last set, if any.
+ */
+void gom_tracker_set_update_counter (volatile gint *counter);
+
+void gom_tracker_sparql_connection_update (TrackerSparqlConnection *connection,
+                                           const gchar *sparql,
+                                           gint priority,
+                                           GCancellable *cancellable,
+                                           GError **error);
+
+GVariant *gom_tracker_sparql_connection_update_blank (TrackerSparqlConnection *connection,
+                                                      const gchar *sparql,
+                                                      gint priority,
+                                                      GCancellable *cancellable,
+                                                      GError **error);
+
 gchar *gom_tracker_sparql_connection_ensure_resource (TrackerSparqlConnection *connection,
                                                       GCancellable *cancellable,
                                                       GError **error,
@@ -54,6 +71,12 @@ gboolean gom_tracker_sparql_connection_set_triple (TrackerSparqlConnection *conn
                                                    const gchar *property_name,
                                                    const gchar *property_value);
 
+gboolean gom_tracker_sparql_connection_delete_resource (TrackerSparqlConnection *connection,
+                                                        GCancellable *cancellable,
+                                                        GError **error,
+                                                        const gchar *datasource_urn,
+                                                        const gchar *identifier);
+
 gboolean gom_tracker_sparql_connection_toggle_favorite (TrackerSparqlConnection *connection,
                                                         GCancellable *cancellable,
                                                         GError **error,
@@ -79,6 +102,12 @@ void gom_tracker_update_datasource (TrackerSparqlConnection  *connection,
                                     const gchar              *resource,
                                     GCancellable             *cancellable,
                                     GError                  **error);
+gboolean gom_tracker_mtime_changed (TrackerSparqlConnection  *connection,
+                                    gint64                    new_mtime,
+                                    gboolean                  resource_exists,
+                                    const gchar              *resource,
+                                    GCancellable             *cancellable,
+                                    GError                  **error);
 gboolean gom_tracker_update_mtime (TrackerSparqlConnection  *connection,
                                    gint64                    new_mtime,
                                    gboolean                  resource_exists,
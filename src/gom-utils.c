@@ -21,8 +21,12 @@
  *
  */
 
+#include <errno.h>
 #include <string.h>
 
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
 #include "gom-utils.h"
 
 static const char *
@@ -138,3 +142,127 @@ gom_iso8601_from_timestamp (gint64 timestamp)
   tv.tv_usec = 0;
   return g_time_val_to_iso8601 (&tv);
 }
+
+static gchar *
+gom_cache_get_path (const gchar *name)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gnome-online-miners", name, NULL);
+}
+
+GKeyFile *
+gom_cache_key_file_load (const gchar *name)
+{
+  GKeyFile *key_file;
+  gchar *path;
+
+  key_file = g_key_file_new ();
+
+  /* a missing or corrupt cache is the same as an empty one */
+  path = gom_cache_get_path (name);
+  g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL);
+  g_free (path);
+
+  return key_file;
+}
+
+gboolean
+gom_cache_key_file_save (GKeyFile *key_file, const gchar *name, GError **error)
+{
+  gboolean ret_val = FALSE;
+  gchar *data = NULL;
+  gchar *dir = NULL;
+  gchar *path;
+  gsize length;
+
+  path = gom_cache_get_path (name);
+  dir = g_path_get_dirname (path);
+  if (g_mkdir_with_parents (dir, 0700) == -1)
+    {
+      gint errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Unable to create %s: %s", dir, g_strerror (errsv));
+      goto out;
+    }
+
+  data = g_key_file_to_data (key_file, &length, NULL);
+  if (!g_file_set_contents (path, data, length, error))
+    goto out;
+
+  ret_val = TRUE;
+
+ out:
+  g_free (data);
+  g_free (dir);
+  g_free (path);
+  return ret_val;
+}
+
+gboolean
+gom_cache_remove (const gchar *name, GError **error)
+{
+  gboolean ret_val = TRUE;
+  gchar *path;
+
+  /* a cache that is already gone is fine */
+  path = gom_cache_get_path (name);
+  if (g_unlink (path) == -1 && errno != ENOENT)
+    {
+      gint errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Unable to remove %s: %s", path, g_strerror (errsv));
+      ret_val = FALSE;
+    }
+
+  g_free (path);
+  return ret_val;
+}
+
+gchar **
+gom_cache_list (void)
+{
+  GDir *dir;
+  GPtrArray *names;
+  const gchar *name;
+  gchar *path;
+
+  names = g_ptr_array_new ();
+
+  path = g_build_filename (g_get_user_cache_dir (), "gnome-online-miners", NULL);
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        g_ptr_array_add (names, g_strdup (name));
+
+      g_dir_close (dir);
+    }
+
+  g_ptr_array_add (names, NULL);
+
+  g_free (path);
+  return (gchar **) g_ptr_array_free (names, FALSE);
+}
+
+GKeyFile *
+gom_config_key_file_load (void)
+{
+  GKeyFile *key_file;
+  GError *error = NULL;
+  gchar *path;
+
+  key_file = g_key_file_new ();
+
+  path = g_build_filename (g_get_user_config_dir (), "gnome-online-miners", "miners.conf", NULL);
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Unable to load %s: %s", path, error->message);
+
+      g_error_free (error);
+    }
+
+  g_free (path);
+  return key_file;
+}
@@ -34,6 +34,16 @@ gchar *gom_filename_strip_extension (const gchar *filename_with_extension);
 
 gchar *gom_iso8601_from_timestamp (gint64 timestamp);
 
+GKeyFile *gom_cache_key_file_load (const gchar *name);
+
+gboolean gom_cache_key_file_save (GKeyFile *key_file, const gchar *name, GError **error);
+
+gboolean gom_cache_remove (const gchar *name, GError **error);
+
+gchar **gom_cache_list (void);
+
+GKeyFile *gom_config_key_file_load (void);
+
 G_END_DECLS
 
 #endif /* __GOM_UTILS_H__ */
@@ -0,0 +1,614 @@
+/*
+ * GNOME Online Miners - crawls through your online content
+ * Copyright (c) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libxml/xmlreader.h>
+
+#include "gom-webdav.h"
+
+#define DAV_NAMESPACE "DAV:"
+
+/* only what the miners look at */
+#define PROPFIND_BODY \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+  "<d:propfind xmlns:d=\"DAV:\">" \
+  "<d:prop>" \
+  "<d:getcontenttype/>" \
+  "<d:getetag/>" \
+  "<d:getlastmodified/>" \
+  "<d:resourcetype/>" \
+  "</d:prop>" \
+  "</d:propfind>"
+
+#define SYNC_TOKEN_BODY \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+  "<d:propfind xmlns:d=\"DAV:\">" \
+  "<d:prop>" \
+  "<d:sync-token/>" \
+  "</d:prop>" \
+  "</d:propfind>"
+
+#define SYNC_COLLECTION_BODY \
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+  "<d:sync-collection xmlns:d=\"DAV:\">" \
+  "<d:sync-token>%s</d:sync-token>" \
+  "<d:sync-level>infinite</d:sync-level>" \
+  "<d:prop>" \
+  "<d:getcontenttype/>" \
+  "<d:getetag/>" \
+  "<d:getlastmodified/>" \
+  "<d:resourcetype/>" \
+  "</d:prop>" \
+  "</d:sync-collection>"
+
+typedef struct {
+  GCancellable *cancellable;
+  GError *error;
+  GInputStream *stream;
+} ReadData;
+
+typedef struct {
+  gboolean is_collection;
+  gchar *content_type;
+  gchar *etag;
+  gchar *last_modified;
+} PropStat;
+
+static void
+authenticate_cb (SoupSession *session, SoupMessage *msg, SoupAuth *auth, gboolean retrying, gpointer user_data)
+{
+  const gchar *password;
+  const gchar *username;
+
+  /* don't lock the account by trying the same password over and over */
+  if (retrying)
+    return;
+
+  username = g_object_get_data (G_OBJECT (session), "gom-webdav-username");
+  password = g_object_get_data (G_OBJECT (session), "gom-webdav-password");
+  soup_auth_authenticate (auth, username, password);
+}
+
+/* max_conns should match the number of threads sharing the session,
+ * libsoup only opens 2 connections per host otherwise
+ */
+SoupSession *
+gom_webdav_session_new (const gchar *username, const gchar *password, gint max_conns)
+{
+  SoupSession *session;
+
+  session = soup_session_new_with_options (SOUP_SESSION_MAX_CONNS, max_conns,
+                                           SOUP_SESSION_MAX_CONNS_PER_HOST, max_conns,
+                                           NULL);
+  g_object_set_data_full (G_OBJECT (session), "gom-webdav-username", g_strdup (username), g_free);
+  g_object_set_data_full (G_OBJECT (session), "gom-webdav-password", g_strdup (password), g_free);
+  g_signal_connect (session, "authenticate", G_CALLBACK (authenticate_cb), NULL);
+
+  return session;
+}
+
+/* GVfs names WebDAV locations dav:// and davs:// */
+static gchar *
+get_http_uri (const gchar *uri)
+{
+  if (g_str_has_prefix (uri, "davs://"))
+    return g_strconcat ("https://", uri + strlen ("davs://"), NULL);
+  else if (g_str_has_prefix (uri, "dav://"))
+    return g_strconcat ("http://", uri + strlen ("dav://"), NULL);
+
+  return g_strdup (uri);
+}
+
+static gchar *
+get_path_without_slash (const gchar *path)
+{
+  gchar *retval;
+  gsize len;
+
+  retval = g_uri_unescape_string (path, NULL);
+  if (retval == NULL)
+    retval = g_strdup (path);
+
+  len = strlen (retval);
+  if (len > 1 && retval[len - 1] == '/')
+    retval[len - 1] = '\0';
+
+  return retval;
+}
+
+static int
+read_cb (void *context, char *buffer, int len)
+{
+  ReadData *data = context;
+  gssize n_read;
+
+  n_read = g_input_stream_read (data->stream, buffer, len, data->cancellable, &data->error);
+  return (int) n_read;
+}
+
+static int
+close_cb (void *context)
+{
+  return 0;
+}
+
+static gboolean
+is_dav_element (xmlTextReaderPtr reader, const gchar *name)
+{
+  const gchar *namespace_uri;
+
+  namespace_uri = (const gchar *) xmlTextReaderConstNamespaceUri (reader);
+  return (g_strcmp0 (namespace_uri, DAV_NAMESPACE) == 0
+          && g_strcmp0 ((const gchar *) xmlTextReaderConstLocalName (reader), name) == 0);
+}
+
+static gchar *
+read_string (xmlTextReaderPtr reader)
+{
+  xmlChar *value;
+  gchar *retval;
+
+  value = xmlTextReaderReadString (reader);
+  retval = g_strdup ((const gchar *) value);
+  xmlFree (value);
+
+  return (retval != NULL) ? g_strstrip (retval) : NULL;
+}
+
+static void
+prop_stat_clear (PropStat *prop_stat)
+{
+  g_free (prop_stat->content_type);
+  g_free (prop_stat->etag);
+  g_free (prop_stat->last_modified);
+  memset (prop_stat, 0, sizeof (*prop_stat));
+}
+
+static GFileInfo *
+create_file_info (const gchar *href, PropStat *prop_stat)
+{
+  GFileInfo *info;
+  gchar *name;
+  gchar *path;
+
+  path = get_path_without_slash (href);
+  name = g_path_get_basename (path);
+
+  info = g_file_info_new ();
+  g_file_info_set_name (info, name);
+  g_file_info_set_display_name (info, name);
+  g_file_info_set_file_type (info, prop_stat->is_collection ? G_FILE_TYPE_DIRECTORY : G_FILE_TYPE_REGULAR);
+
+  if (prop_stat->content_type != NULL)
+    g_file_info_set_content_type (info, prop_stat->content_type);
+
+  if (prop_stat->etag != NULL)
+    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_ETAG_VALUE, prop_stat->etag);
+
+  if (prop_stat->last_modified != NULL)
+    {
+      SoupDate *date;
+
+      date = soup_date_new_from_string (prop_stat->last_modified);
+      if (date != NULL)
+        {
+          GTimeVal tv;
+
+          soup_date_to_timeval (date, &tv);
+          g_file_info_set_modification_time (info, &tv);
+          soup_date_free (date);
+        }
+    }
+
+  g_free (name);
+  g_free (path);
+  return info;
+}
+
+typedef void (*ResponseFunc) (const gchar *href, const gchar *status, PropStat *prop_stat, gpointer user_data);
+
+static GInputStream *
+send_request (SoupSession *session,
+              const gchar *method,
+              const gchar *uri,
+              const gchar *depth,
+              const gchar *body,
+              gchar **out_path,
+              GCancellable *cancellable,
+              GError **error)
+{
+  GInputStream *retval = NULL;
+  GInputStream *stream = NULL;
+  SoupMessage *msg = NULL;
+  gchar *http_uri;
+
+  http_uri = get_http_uri (uri);
+  msg = soup_message_new (method, http_uri);
+  if (msg == NULL)
+    {
+      /* FIXME: use proper #defines and enumerated types */
+      g_set_error (error,
+                   g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Invalid WebDAV location %s", uri);
+      goto out;
+    }
+
+  if (depth != NULL)
+    soup_message_headers_append (msg->request_headers, "Depth", depth);
+
+  soup_message_set_request (msg, "application/xml", SOUP_MEMORY_COPY, body, strlen (body));
+
+  stream = soup_session_send (session, msg, cancellable, error);
+  if (stream == NULL)
+    goto out;
+
+  if (msg->status_code != SOUP_STATUS_MULTI_STATUS)
+    {
+      g_set_error (error,
+                   g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Unable to %s %s: %u %s", method, uri, msg->status_code, msg->reason_phrase);
+      goto out;
+    }
+
+  if (out_path != NULL)
+    *out_path = get_path_without_slash (soup_uri_get_path (soup_message_get_uri (msg)));
+
+  retval = g_object_ref (stream);
+
+ out:
+  g_clear_object (&stream);
+  g_clear_object (&msg);
+  g_free (http_uri);
+  return retval;
+}
+
+/* The multistatus response is parsed while it is being read, and
+ * each response is handed over as soon as it is complete.
+ */
+static gboolean
+parse_multistatus (GInputStream *stream,
+                   const gchar *uri,
+                   ResponseFunc func,
+                   gpointer user_data,
+                   gchar **out_sync_token,
+                   GCancellable *cancellable,
+                   GError **error)
+{
+  PropStat prop_stat;
+  PropStat response_prop_stat;
+  ReadData data;
+  gboolean in_propstat = FALSE;
+  gboolean retval = FALSE;
+  gchar *href = NULL;
+  gchar *response_status = NULL;
+  gchar *status = NULL;
+  gchar *sync_token = NULL;
+  int ret;
+  xmlTextReaderPtr reader;
+
+  memset (&data, 0, sizeof (data));
+  memset (&prop_stat, 0, sizeof (prop_stat));
+  memset (&response_prop_stat, 0, sizeof (response_prop_stat));
+
+  data.cancellable = cancellable;
+  data.stream = stream;
+
+  reader = xmlReaderForIO (read_cb, close_cb, &data, uri, NULL, XML_PARSE_NONET | XML_PARSE_NOBLANKS);
+  if (reader == NULL)
+    {
+      g_set_error (error,
+                   g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Unable to parse the response for %s", uri);
+      goto out;
+    }
+
+  while ((ret = xmlTextReaderRead (reader)) == 1)
+    {
+      int node_type;
+
+      node_type = xmlTextReaderNodeType (reader);
+
+      if (node_type == XML_READER_TYPE_ELEMENT)
+        {
+          if (is_dav_element (reader, "href"))
+            {
+              g_free (href);
+              href = read_string (reader);
+            }
+          else if (is_dav_element (reader, "propstat"))
+            {
+              in_propstat = !xmlTextReaderIsEmptyElement (reader);
+            }
+          else if (is_dav_element (reader, "status"))
+            {
+              gchar **location = in_propstat ? &status : &response_status;
+
+              g_free (*location);
+              *location = read_string (reader);
+            }
+          else if (is_dav_element (reader, "sync-token"))
+            {
+              g_free (sync_token);
+              sync_token = read_string (reader);
+            }
+          else if (is_dav_element (reader, "getcontenttype"))
+            {
+              g_free (prop_stat.content_type);
+              prop_stat.content_type = read_string (reader);
+            }
+          else if (is_dav_element (reader, "getetag"))
+            {
+              g_free (prop_stat.etag);
+              prop_stat.etag = read_string (reader);
+            }
+          else if (is_dav_element (reader, "getlastmodified"))
+            {
+              g_free (prop_stat.last_modified);
+              prop_stat.last_modified = read_string (reader);
+            }
+          else if (is_dav_element (reader, "collection"))
+            {
+              prop_stat.is_collection = TRUE;
+            }
+        }
+      else if (node_type == XML_READER_TYPE_END_ELEMENT)
+        {
+          if (is_dav_element (reader, "propstat"))
+            {
+              /* the properties that were not found come in a separate
+               * propstat with a 404 status
+               */
+              if (status != NULL && strstr (status, " 200 ") != NULL)
+                {
+                  prop_stat_clear (&response_prop_stat);
+                  response_prop_stat = prop_stat;
+                  memset (&prop_stat, 0, sizeof (prop_stat));
+                }
+
+              prop_stat_clear (&prop_stat);
+              g_clear_pointer (&status, g_free);
+              in_propstat = FALSE;
+            }
+          else if (is_dav_element (reader, "response"))
+            {
+              if (href != NULL)
+                func (href, response_status, &response_prop_stat, user_data);
+
+              prop_stat_clear (&response_prop_stat);
+              g_clear_pointer (&href, g_free);
+              g_clear_pointer (&response_status, g_free);
+            }
+        }
+    }
+
+  if (data.error != NULL)
+    {
+      g_propagate_error (error, data.error);
+      data.error = NULL;
+      goto out;
+    }
+
+  if (ret < 0)
+    {
+      g_set_error (error,
+                   g_quark_from_static_string ("gom-error"),
+                   0,
+                   "Unable to parse the response for %s", uri);
+      goto out;
+    }
+
+  if (out_sync_token != NULL)
+    {
+      *out_sync_token = sync_token;
+      sync_token = NULL;
+    }
+
+  retval = TRUE;
+
+ out:
+  if (reader != NULL)
+    xmlFreeTextReader (reader);
+
+  prop_stat_clear (&prop_stat);
+  prop_stat_clear (&response_prop_stat);
+  g_free (href);
+  g_free (response_status);
+  g_free (status);
+  g_free (sync_token);
+  return retval;
+}
+
+typedef struct {
+  GList *infos;
+  const gchar *self_path;
+} ListData;
+
+static void
+list_children_response_func (const gchar *href, const gchar *status, PropStat *prop_stat, gpointer user_data)
+{
+  ListData *data = user_data;
+  gchar *path;
+
+  /* the collection itself is part of the response */
+  path = get_path_without_slash (href);
+  if (g_strcmp0 (path, data->self_path) != 0)
+    data->infos = g_list_prepend (data->infos, create_file_info (href, prop_stat));
+
+  g_free (path);
+}
+
+/* Lists a collection with a Depth: 1 PROPFIND, leaving out the
+ * collection itself.
+ */
+GList *
+gom_webdav_list_children (SoupSession *session,
+                          const gchar *uri,
+                          GCancellable *cancellable,
+                          GError **error)
+{
+  GInputStream *stream;
+  ListData data;
+  gchar *self_path = NULL;
+
+  data.infos = NULL;
+
+  stream = send_request (session, "PROPFIND", uri, "1", PROPFIND_BODY, &self_path, cancellable, error);
+  if (stream == NULL)
+    goto out;
+
+  data.self_path = self_path;
+  if (!parse_multistatus (stream, uri, list_children_response_func, &data, NULL, cancellable, error))
+    {
+      g_list_free_full (data.infos, g_object_unref);
+      data.infos = NULL;
+      goto out;
+    }
+
+  data.infos = g_list_reverse (data.infos);
+
+ out:
+  g_clear_object (&stream);
+  g_free (self_path);
+  return data.infos;
+}
+
+static void
+ignore_response_func (const gchar *href, const gchar *status, PropStat *prop_stat, gpointer user_data)
+{
+}
+
+/* Returns NULL if the server doesn't support sync-collection for the
+ * collection.
+ */
+gchar *
+gom_webdav_get_sync_token (SoupSession *session,
+                           const gchar *uri,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+  GInputStream *stream;
+  gchar *retval = NULL;
+
+  stream = send_request (session, "PROPFIND", uri, "0", SYNC_TOKEN_BODY, NULL, cancellable, error);
+  if (stream == NULL)
+    goto out;
+
+  parse_multistatus (stream, uri, ignore_response_func, NULL, &retval, cancellable, error);
+
+ out:
+  g_clear_object (&stream);
+  return retval;
+}
+
+void
+gom_webdav_change_free (GomWebdavChange *change)
+{
+  g_free (change->path);
+  g_clear_object (&change->info);
+  g_slice_free (GomWebdavChange, change);
+}
+
+typedef struct {
+  GList *changes;
+  const gchar *self_path;
+} SyncData;
+
+static void
+sync_collection_response_func (const gchar *href, const gchar *status, PropStat *prop_stat, gpointer user_data)
+{
+  GomWebdavChange *change;
+  SyncData *data = user_data;
+  gchar *path;
+  gchar *prefix;
+
+  path = get_path_without_slash (href);
+  prefix = g_str_has_suffix (data->self_path, "/") ? g_strdup (data->self_path) : g_strconcat (data->self_path, "/", NULL);
+
+  /* only the members, relative to the collection */
+  if (!g_str_has_prefix (path, prefix) || path[strlen (prefix)] == '\0')
+    goto out;
+
+  change = g_slice_new0 (GomWebdavChange);
+  change->path = g_strdup (path + strlen (prefix));
+
+  /* removed members only come with a 404 status */
+  if (status == NULL || strstr (status, " 404 ") == NULL)
+    change->info = create_file_info (href, prop_stat);
+
+  data->changes = g_list_prepend (data->changes, change);
+
+ out:
+  g_free (path);
+  g_free (prefix);
+}
+
+/* Asks for the members of a collection that changed since the
+ * sync_token was handed out, as per RFC 6578. The server rejects
+ * tokens that are too old, and the caller is expected to list the
+ * whole collection then.
+ */
+GList *
+gom_webdav_sync_collection (SoupSession *session,
+                            const gchar *uri,
+                            const gchar *sync_token,
+                            gchar **out_sync_token,
+                            GCancellable *cancellable,
+                            GError **error)
+{
+  GInputStream *stream;
+  SyncData data;
+  gchar *body;
+  gchar *escaped;
+  gchar *self_path = NULL;
+
+  data.changes = NULL;
+
+  escaped = g_markup_escape_text (sync_token, -1);
+  body = g_strdup_printf (SYNC_COLLECTION_BODY, escaped);
+  g_free (escaped);
+
+  stream = send_request (session, "REPORT", uri, NULL, body, &self_path, cancellable, error);
+  g_free (body);
+
+  if (stream == NULL)
+    goto out;
+
+  data.self_path = self_path;
+  if (!parse_multistatus (stream, uri, sync_collection_response_func, &data, out_sync_token, cancellable, error))
+    {
+      g_list_free_full (data.changes, (GDestroyNotify) gom_webdav_change_free);
+      data.changes = NULL;
+      goto out;
+    }
+
+  data.changes = g_list_reverse (data.changes);
+
+ out:
+  g_clear_object (&stream);
+  g_free (self_path);
+  return data.changes;
+}
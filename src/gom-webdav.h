@@ -0,0 +1,58 @@
+/*
+ * GNOME Online Miners - crawls through your online content
+ * Copyright (c) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+#ifndef __GOM_WEBDAV_H__
+#define __GOM_WEBDAV_H__
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+  gchar *path;
+  GFileInfo *info;
+} GomWebdavChange;
+
+void gom_webdav_change_free (GomWebdavChange *change);
+
+SoupSession *gom_webdav_session_new (const gchar *username, const gchar *password, gint max_conns);
+
+GList *gom_webdav_list_children (SoupSession *session,
+                                 const gchar *uri,
+                                 GCancellable *cancellable,
+                                 GError **error);
+
+gchar *gom_webdav_get_sync_token (SoupSession *session,
+                                  const gchar *uri,
+                                  GCancellable *cancellable,
+                                  GError **error);
+
+GList *gom_webdav_sync_collection (SoupSession *session,
+                                   const gchar *uri,
+                                   const gchar *sync_token,
+                                   gchar **out_sync_token,
+                                   GCancellable *cancellable,
+                                   GError **error);
+
+G_END_DECLS
+
+#endif /* __GOM_WEBDAV_H__ */
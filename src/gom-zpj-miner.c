@@ -215,6 +215,7 @@ account_miner_job_traverse_folder (GomAccountMinerJob *job,
                                    GHashTable *previous_resources,
                                    const gchar *datasource_urn,
                                    const gchar *folder_id,
+                                   const gchar *folder_path,
                                    GCancellable *cancellable,
                                    GError **error)
 {
@@ -244,16 +245,25 @@ account_miner_job_traverse_folder (GomAccountMinerJob *job,
     {
       ZpjSkydriveEntry *entry = (ZpjSkydriveEntry *) l->data;
       const gchar *id;
+      gboolean excluded;
+      gchar *path;
 
       id = zpj_skydrive_entry_get_id (entry);
+      path = g_build_path ("/", folder_path, zpj_skydrive_entry_get_name (entry), NULL);
+      excluded = gom_account_miner_job_is_path_excluded (job, path, ZPJ_IS_SKYDRIVE_FOLDER (entry));
 
-      if (ZPJ_IS_SKYDRIVE_FOLDER (entry))
-        {
-          account_miner_job_traverse_folder (job, connection, previous_resources, datasource_urn, id, cancellable, error);
-          if (*error != NULL)
-            goto out;
-        }
-      else if (ZPJ_IS_SKYDRIVE_PHOTO (entry))
+      if (ZPJ_IS_SKYDRIVE_FOLDER (entry) && !excluded)
+        account_miner_job_traverse_folder (job, connection, previous_resources, datasource_urn, id, path, cancellable, error);
+
+      g_free (path);
+
+      if (*error != NULL)
+        goto out;
+
+      /* excluded entries are left in previous_resources, so that
+       * they get removed
+       */
+      if (excluded || ZPJ_IS_SKYDRIVE_PHOTO (entry))
         continue;
 
       account_miner_job_process_entry (job, connection, previous_resources, datasource_urn, entry, cancellable, error);
@@ -283,13 +293,15 @@ query_zpj (GomAccountMinerJob *job,
                                      previous_resources,
                                      datasource_urn,
                                      ZPJ_SKYDRIVE_FOLDER_SKYDRIVE,
+                                     "/",
                                      cancellable,
                                      error);
 }
 
 static GHashTable *
 create_services (GomMiner *self,
-                 GoaObject *object)
+                 GoaObject *object,
+                 const gchar **index_types)
 {
   GHashTable *services;
   ZpjGoaAuthorizer *authorizer;
@@ -298,7 +310,7 @@ create_services (GomMiner *self,
   services = g_hash_table_new_full (g_str_hash, g_str_equal,
                                     NULL, (GDestroyNotify) g_object_unref);
 
-  if (gom_miner_supports_type (self, "documents"))
+  if (gom_miner_supports_type (index_types, "documents"))
     {
       authorizer = zpj_goa_authorizer_new (object);
       service = zpj_skydrive_new (ZPJ_AUTHORIZER (authorizer));
@@ -0,0 +1,499 @@
+/*
+ * GNOME Online Miners - crawls through your online content
+ * Copyright (c) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+/* Crawls a generated tree served by webdav-server.py with the ownCloud
+ * miner's WebDAV backend, storing into a Tracker started on a private
+ * bus, under a temporary home. A stand-in for GOA on the same bus
+ * provides the account.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <goa/goa.h>
+
+#include "gom-owncloud-miner.h"
+
+/* what webdav-server.py accepts */
+#define USERNAME "user"
+#define PASSWORD "secret"
+
+#define ACCOUNT_ID "bench"
+#define ACCOUNT_PATH "/org/gnome/OnlineAccounts/Accounts/" ACCOUNT_ID
+
+static gint n_files = 100000;
+static gint n_dirs = 5000;
+static gint depth = 4;
+static gint fan_out = 20;
+static gint concurrency = 0;
+
+static GOptionEntry entries[] =
+{
+  { "files", 0, 0, G_OPTION_ARG_INT, &n_files, "Number of files in the tree", "N" },
+  { "dirs", 0, 0, G_OPTION_ARG_INT, &n_dirs, "Number of directories in the tree", "N" },
+  { "depth", 0, 0, G_OPTION_ARG_INT, &depth, "Maximum depth of the tree", "N" },
+  { "fan-out", 0, 0, G_OPTION_ARG_INT, &fan_out, "Maximum number of directories in a directory", "N" },
+  { "concurrency", 0, 0, G_OPTION_ARG_INT, &concurrency, "Directories listed at once (default: the miner's)", "N" },
+  { NULL }
+};
+
+static GMainLoop *loop;
+
+static GPid server_pid;
+static gint server_stdin = -1;
+static GIOChannel *server_channel;
+
+/* from the miner's statistics */
+static gint job_entries = -1;
+static gint job_requests;
+static gint job_updates;
+
+static void
+log_handler (const gchar *log_domain,
+             GLogLevelFlags log_level,
+             const gchar *message,
+             gpointer user_data)
+{
+  gint entries, requests, updates;
+
+  if (sscanf (message,
+              "Account " ACCOUNT_ID ": %d entries in %d requests and %d updates",
+              &entries, &requests, &updates) == 3)
+    {
+      job_entries = entries;
+      job_requests = requests;
+      job_updates = updates;
+    }
+
+  g_log_default_handler (log_domain, log_level, message, user_data);
+}
+
+static void
+remove_recursively (const gchar *path)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child;
+
+          child = g_build_filename (path, name, NULL);
+          if (g_file_test (child, G_FILE_TEST_IS_DIR) && !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+            remove_recursively (child);
+          else
+            g_unlink (child);
+
+          g_free (child);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_remove (path);
+}
+
+static gboolean
+write_config (const gchar *home, GError **error)
+{
+  GString *contents;
+  gboolean retval = FALSE;
+  gchar *dir;
+  gchar *path;
+
+  dir = g_build_filename (home, "config", "gnome-online-miners", NULL);
+  path = g_build_filename (dir, "miners.conf", NULL);
+
+  if (g_mkdir_with_parents (dir, 0700) != 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Unable to create %s", dir);
+      goto out;
+    }
+
+  contents = g_string_new ("[owncloud]\nbackend=webdav\n");
+  if (concurrency > 0)
+    g_string_append_printf (contents, "traverse-concurrency=%d\n", concurrency);
+
+  retval = g_file_set_contents (path, contents->str, -1, error);
+  g_string_free (contents, TRUE);
+
+ out:
+  g_free (path);
+  g_free (dir);
+  return retval;
+}
+
+static guint
+start_server (void)
+{
+  GError *error = NULL;
+  gchar *argv[] = { PYTHON, SRCDIR "/webdav-server.py",
+                    "--files", NULL, "--dirs", NULL, "--depth", NULL, "--fan-out", NULL,
+                    NULL };
+  gchar *line = NULL;
+  gint server_stdout;
+  guint port = 0;
+
+  argv[3] = g_strdup_printf ("%d", n_files);
+  argv[5] = g_strdup_printf ("%d", n_dirs);
+  argv[7] = g_strdup_printf ("%d", depth);
+  argv[9] = g_strdup_printf ("%d", fan_out);
+
+  if (!g_spawn_async_with_pipes (NULL, argv, NULL, 0, NULL, NULL,
+                                 &server_pid, &server_stdin, &server_stdout, NULL,
+                                 &error))
+    {
+      g_printerr ("Unable to start the WebDAV server: %s\n", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  /* the server tells which port it listens on once it is ready */
+  server_channel = g_io_channel_unix_new (server_stdout);
+  g_io_channel_set_close_on_unref (server_channel, TRUE);
+  g_io_channel_read_line (server_channel, &line, NULL, NULL, NULL);
+
+  if (line != NULL)
+    port = (guint) g_ascii_strtoull (line, NULL, 10);
+
+ out:
+  g_free (line);
+  g_free (argv[3]);
+  g_free (argv[5]);
+  g_free (argv[7]);
+  g_free (argv[9]);
+  return port;
+}
+
+static void
+stop_server (gint *n_propfinds, gint *n_server_dirs, gint *n_server_files)
+{
+  gchar *line;
+
+  if (server_channel == NULL)
+    return;
+
+  /* the server exits once its standard input is closed, after
+   * printing what it served
+   */
+  close (server_stdin);
+
+  while (g_io_channel_read_line (server_channel, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL)
+    {
+      sscanf (line, "propfind %d", n_propfinds);
+      sscanf (line, "dirs %d", n_server_dirs);
+      sscanf (line, "files %d", n_server_files);
+      g_free (line);
+    }
+
+  g_io_channel_unref (server_channel);
+  waitpid (server_pid, NULL, 0);
+  g_spawn_close_pid (server_pid);
+}
+
+static gboolean
+handle_get_password (GoaPasswordBased *password_based,
+                     GDBusMethodInvocation *invocation,
+                     const gchar *id,
+                     gpointer user_data)
+{
+  goa_password_based_complete_get_password (password_based, invocation, PASSWORD);
+  return TRUE;
+}
+
+static GDBusObjectManagerServer *
+export_account (GDBusConnection *connection, guint port)
+{
+  GDBusObjectManagerServer *manager;
+  GoaAccount *account;
+  GoaFiles *files;
+  GoaObjectSkeleton *object;
+  GoaPasswordBased *password_based;
+  gchar *presentation_identity;
+  gchar *uri;
+
+  presentation_identity = g_strdup_printf (USERNAME "@127.0.0.1:%u", port);
+  uri = g_strdup_printf ("dav://127.0.0.1:%u/remote.php/webdav/", port);
+
+  account = goa_account_skeleton_new ();
+  goa_account_set_id (account, ACCOUNT_ID);
+  goa_account_set_provider_type (account, "owncloud");
+  goa_account_set_provider_name (account, "ownCloud");
+  goa_account_set_identity (account, USERNAME);
+  goa_account_set_presentation_identity (account, presentation_identity);
+
+  files = goa_files_skeleton_new ();
+  goa_files_set_uri (files, uri);
+
+  password_based = goa_password_based_skeleton_new ();
+  g_signal_connect (password_based, "handle-get-password", G_CALLBACK (handle_get_password), NULL);
+
+  object = goa_object_skeleton_new (ACCOUNT_PATH);
+  goa_object_skeleton_set_account (object, account);
+  goa_object_skeleton_set_files (object, files);
+  goa_object_skeleton_set_password_based (object, password_based);
+
+  manager = g_dbus_object_manager_server_new ("/org/gnome/OnlineAccounts");
+  g_dbus_object_manager_server_export (manager, G_DBUS_OBJECT_SKELETON (object));
+  g_dbus_object_manager_server_set_connection (manager, connection);
+
+  g_object_unref (object);
+  g_object_unref (password_based);
+  g_object_unref (files);
+  g_object_unref (account);
+  g_free (uri);
+  g_free (presentation_identity);
+
+  return manager;
+}
+
+static void
+name_acquired_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  gboolean *owned = user_data;
+
+  *owned = TRUE;
+  g_main_loop_quit (loop);
+}
+
+static void
+name_lost_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+miner_new_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GError *error = NULL;
+  GObject **miner = user_data;
+
+  *miner = g_async_initable_new_finish (G_ASYNC_INITABLE (source_object), res, &error);
+  if (error != NULL)
+    {
+      g_printerr ("Unable to create the miner: %s\n", error->message);
+      g_error_free (error);
+    }
+
+  g_main_loop_quit (loop);
+}
+
+static void
+refresh_db_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GError *error = NULL;
+  gboolean *refreshed = user_data;
+
+  *refreshed = gom_miner_refresh_db_finish (GOM_MINER (source_object), res, &error);
+  if (error != NULL)
+    {
+      g_printerr ("Unable to refresh: %s\n", error->message);
+      g_error_free (error);
+    }
+
+  g_main_loop_quit (loop);
+}
+
+int
+main (int argc, char **argv)
+{
+  const gchar *index_types[] = { "documents", NULL };
+  GDBusConnection *connection = NULL;
+  GDBusObjectManagerServer *manager = NULL;
+  GError *error = NULL;
+  GObject *miner = NULL;
+  GOptionContext *context;
+  GTestDBus *bus = NULL;
+  gboolean owned = FALSE;
+  gboolean refreshed = FALSE;
+  gchar *home = NULL;
+  gchar *path;
+  gint64 elapsed;
+  gint n_propfinds = -1;
+  gint n_server_dirs = 0;
+  gint n_server_files = 0;
+  gint retval = 1;
+  guint owner_id = 0;
+  guint port;
+  struct rusage usage;
+
+  context = g_option_context_new ("- benchmark the ownCloud WebDAV backend");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (g_strcmp0 (PYTHON, "no") == 0)
+    {
+      g_printerr ("The benchmark needs python3\n");
+      return 1;
+    }
+
+  /* everything below the temporary home, and nothing from the
+   * desktop session; this has to happen before anything caches the
+   * user directories
+   */
+  home = g_dir_make_tmp ("gom-bench-XXXXXX", &error);
+  if (home == NULL)
+    {
+      g_printerr ("Unable to create a temporary directory: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  path = g_build_filename (home, "data", NULL);
+  g_setenv ("XDG_DATA_HOME", path, TRUE);
+  g_free (path);
+
+  path = g_build_filename (home, "cache", NULL);
+  g_setenv ("XDG_CACHE_HOME", path, TRUE);
+  g_free (path);
+
+  path = g_build_filename (home, "config", NULL);
+  g_setenv ("XDG_CONFIG_HOME", path, TRUE);
+  g_free (path);
+
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+  g_setenv ("GIO_USE_VFS", "local", TRUE);
+  g_setenv ("GIO_USE_VOLUME_MONITOR", "unix", TRUE);
+
+  if (!write_config (home, &error))
+    {
+      g_printerr ("Unable to write the configuration: %s\n", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  g_log_set_handler ("Gom", G_LOG_LEVEL_DEBUG, log_handler, NULL);
+  loop = g_main_loop_new (NULL, FALSE);
+
+  port = start_server ();
+  if (port == 0)
+    goto out_server;
+
+  /* Tracker gets activated on the private bus */
+  bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_add_service_dir (bus, TRACKER_DBUS_SERVICES_DIR);
+  g_test_dbus_up (bus);
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (connection == NULL)
+    {
+      g_printerr ("Unable to connect to the private bus: %s\n", error->message);
+      g_error_free (error);
+      goto out_server;
+    }
+
+  manager = export_account (connection, port);
+
+  owner_id = g_bus_own_name_on_connection (connection,
+                                           "org.gnome.OnlineAccounts",
+                                           G_BUS_NAME_OWNER_FLAGS_NONE,
+                                           name_acquired_cb,
+                                           name_lost_cb,
+                                           &owned,
+                                           NULL);
+  g_main_loop_run (loop);
+  if (!owned)
+    {
+      g_printerr ("Unable to own org.gnome.OnlineAccounts\n");
+      goto out_server;
+    }
+
+  g_async_initable_new_async (GOM_TYPE_OWNCLOUD_MINER,
+                              G_PRIORITY_DEFAULT,
+                              NULL,
+                              miner_new_cb,
+                              &miner,
+                              NULL);
+  g_main_loop_run (loop);
+  if (miner == NULL)
+    goto out_server;
+
+  elapsed = g_get_monotonic_time ();
+  gom_miner_refresh_db_async (GOM_MINER (miner), index_types, TRUE, NULL, refresh_db_cb, &refreshed);
+  g_main_loop_run (loop);
+  elapsed = (g_get_monotonic_time () - elapsed) / 1000;
+
+ out_server:
+  stop_server (&n_propfinds, &n_server_dirs, &n_server_files);
+
+  if (!refreshed)
+    goto out;
+
+  if (job_entries < 0)
+    {
+      g_printerr ("The miner did not log its statistics\n");
+      goto out;
+    }
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  g_print ("tree:            %d files in %d directories\n", n_server_files, n_server_dirs);
+  g_print ("time:            %" G_GINT64_FORMAT " ms\n", elapsed);
+  g_print ("files/s:         %.1f\n", (elapsed > 0) ? n_server_files * 1000.0 / elapsed : 0.0);
+  g_print ("entries:         %d\n", job_entries);
+  g_print ("PROPFINDs:       %d (%d counted by the miner)\n", n_propfinds, job_requests);
+  g_print ("Tracker updates: %d\n", job_updates);
+  g_print ("peak RSS:        %ld KiB\n", usage.ru_maxrss);
+
+  retval = 0;
+
+ out:
+  g_clear_object (&miner);
+
+  if (owner_id != 0)
+    g_bus_unown_name (owner_id);
+
+  g_clear_object (&manager);
+  g_clear_object (&connection);
+
+  if (bus != NULL)
+    {
+      g_test_dbus_down (bus);
+      g_object_unref (bus);
+    }
+
+  if (loop != NULL)
+    g_main_loop_unref (loop);
+
+  remove_recursively (home);
+  g_free (home);
+
+  return retval;
+}
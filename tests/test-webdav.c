@@ -0,0 +1,259 @@
+/*
+ * GNOME Online Miners - crawls through your online content
+ * Copyright (c) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gom-webdav.h"
+
+/* the canned responses of webdav-server.py */
+#define USERNAME "user"
+#define PASSWORD "secret"
+#define SYNC_TOKEN "http://example.com/ns/sync/1"
+#define NEXT_SYNC_TOKEN "http://example.com/ns/sync/2"
+
+static GPid server_pid;
+static gint server_stdin = -1;
+static gchar *root_uri;
+
+static gboolean
+start_server (void)
+{
+  GError *error = NULL;
+  GIOChannel *channel;
+  gchar *argv[] = { PYTHON, SRCDIR "/webdav-server.py", NULL };
+  gchar *line = NULL;
+  gint server_stdout;
+  guint port;
+
+  if (!g_spawn_async_with_pipes (NULL, argv, NULL, 0, NULL, NULL,
+                                 &server_pid, &server_stdin, &server_stdout, NULL,
+                                 &error))
+    {
+      g_printerr ("Unable to start the WebDAV server: %s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  /* the server tells which port it listens on once it is ready */
+  channel = g_io_channel_unix_new (server_stdout);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+  g_io_channel_read_line (channel, &line, NULL, NULL, NULL);
+  g_io_channel_unref (channel);
+
+  port = (line != NULL) ? (guint) g_ascii_strtoull (line, NULL, 10) : 0;
+  g_free (line);
+
+  if (port == 0)
+    return FALSE;
+
+  root_uri = g_strdup_printf ("dav://127.0.0.1:%u/remote.php/webdav/", port);
+  return TRUE;
+}
+
+static void
+stop_server (void)
+{
+  /* the server exits once its standard input is closed */
+  close (server_stdin);
+  waitpid (server_pid, NULL, 0);
+  g_spawn_close_pid (server_pid);
+  g_free (root_uri);
+}
+
+static GFileInfo *
+find_info (GList *infos, const gchar *name)
+{
+  GList *l;
+
+  for (l = infos; l != NULL; l = l->next)
+    {
+      if (g_strcmp0 (g_file_info_get_name (l->data), name) == 0)
+        return l->data;
+    }
+
+  return NULL;
+}
+
+static GomWebdavChange *
+find_change (GList *changes, const gchar *path)
+{
+  GList *l;
+
+  for (l = changes; l != NULL; l = l->next)
+    {
+      GomWebdavChange *change = l->data;
+
+      if (g_strcmp0 (change->path, path) == 0)
+        return change;
+    }
+
+  return NULL;
+}
+
+static void
+test_list_children (void)
+{
+  GError *error = NULL;
+  GFileInfo *info;
+  GList *infos;
+  GTimeVal tv;
+  SoupSession *session;
+
+  session = gom_webdav_session_new (USERNAME, PASSWORD, 4);
+  infos = gom_webdav_list_children (session, root_uri, NULL, &error);
+  g_assert_no_error (error);
+
+  /* the collection itself is left out */
+  g_assert_cmpuint (g_list_length (infos), ==, 2);
+
+  /* the properties that were not found don't override the others */
+  info = find_info (infos, "Photos");
+  g_assert (info != NULL);
+  g_assert_cmpint (g_file_info_get_file_type (info), ==, G_FILE_TYPE_DIRECTORY);
+  g_assert (g_file_info_get_content_type (info) == NULL);
+  g_assert_cmpstr (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ETAG_VALUE), ==, "\"photos\"");
+
+  /* the name is unescaped */
+  info = find_info (infos, "file one.txt");
+  g_assert (info != NULL);
+  g_assert_cmpint (g_file_info_get_file_type (info), ==, G_FILE_TYPE_REGULAR);
+  g_assert_cmpstr (g_file_info_get_content_type (info), ==, "text/plain");
+  g_assert_cmpstr (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ETAG_VALUE), ==, "\"file\"");
+
+  g_file_info_get_modification_time (info, &tv);
+  g_assert_cmpint (tv.tv_sec, ==, 1383741000);
+
+  g_list_free_full (infos, g_object_unref);
+  g_object_unref (session);
+}
+
+static void
+test_list_children_unauthorized (void)
+{
+  GError *error = NULL;
+  GList *infos;
+  SoupSession *session;
+
+  session = gom_webdav_session_new (USERNAME, "wrong", 4);
+  infos = gom_webdav_list_children (session, root_uri, NULL, &error);
+  g_assert (error != NULL);
+  g_assert (infos == NULL);
+
+  g_error_free (error);
+  g_object_unref (session);
+}
+
+static void
+test_get_sync_token (void)
+{
+  GError *error = NULL;
+  SoupSession *session;
+  gchar *sync_token;
+
+  session = gom_webdav_session_new (USERNAME, PASSWORD, 4);
+  sync_token = gom_webdav_get_sync_token (session, root_uri, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (sync_token, ==, SYNC_TOKEN);
+
+  g_free (sync_token);
+  g_object_unref (session);
+}
+
+static void
+test_sync_collection (void)
+{
+  GError *error = NULL;
+  GList *changes;
+  GTimeVal tv;
+  GomWebdavChange *change;
+  SoupSession *session;
+  gchar *sync_token = NULL;
+
+  session = gom_webdav_session_new (USERNAME, PASSWORD, 4);
+  changes = gom_webdav_sync_collection (session, root_uri, SYNC_TOKEN, &sync_token, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (sync_token, ==, NEXT_SYNC_TOKEN);
+  g_assert_cmpuint (g_list_length (changes), ==, 2);
+
+  /* paths are relative to the collection, and unescaped */
+  change = find_change (changes, "Photos/new photo.jpg");
+  g_assert (change != NULL);
+  g_assert (change->info != NULL);
+  g_assert_cmpstr (g_file_info_get_name (change->info), ==, "new photo.jpg");
+  g_assert_cmpstr (g_file_info_get_content_type (change->info), ==, "image/jpeg");
+
+  g_file_info_get_modification_time (change->info, &tv);
+  g_assert_cmpint (tv.tv_sec, ==, 1383812100);
+
+  /* removed members have no info */
+  change = find_change (changes, "old.txt");
+  g_assert (change != NULL);
+  g_assert (change->info == NULL);
+
+  g_list_free_full (changes, (GDestroyNotify) gom_webdav_change_free);
+  g_free (sync_token);
+  g_object_unref (session);
+}
+
+static void
+test_sync_collection_invalid_token (void)
+{
+  GError *error = NULL;
+  GList *changes;
+  SoupSession *session;
+  gchar *sync_token = NULL;
+
+  session = gom_webdav_session_new (USERNAME, PASSWORD, 4);
+  changes = gom_webdav_sync_collection (session, root_uri, "expired", &sync_token, NULL, &error);
+  g_assert (error != NULL);
+  g_assert (changes == NULL);
+  g_assert (sync_token == NULL);
+
+  g_error_free (error);
+  g_object_unref (session);
+}
+
+int
+main (int argc, char **argv)
+{
+  gint retval;
+
+  g_test_init (&argc, &argv, NULL);
+
+  /* automake treats 77 as a skipped test */
+  if (g_strcmp0 (PYTHON, "no") == 0 || !start_server ())
+    return 77;
+
+  g_test_add_func ("/webdav/list-children", test_list_children);
+  g_test_add_func ("/webdav/list-children-unauthorized", test_list_children_unauthorized);
+  g_test_add_func ("/webdav/get-sync-token", test_get_sync_token);
+  g_test_add_func ("/webdav/sync-collection", test_sync_collection);
+  g_test_add_func ("/webdav/sync-collection-invalid-token", test_sync_collection_invalid_token);
+
+  retval = g_test_run ();
+
+  stop_server ();
+  return retval;
+}
@@ -0,0 +1,309 @@
+#!/usr/bin/env python3
+#
+# GNOME Online Miners - crawls through your online content
+# Copyright (c) 2013 Red Hat, Inc.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+#
+
+# A stand-in for an ownCloud WebDAV server. It prints the port it
+# listens on, and exits when its standard input is closed.
+#
+# By default it answers with canned responses. With --files, it serves
+# a generated tree instead, and prints how many requests it got before
+# exiting.
+
+import argparse
+import base64
+import http.server
+import socketserver
+import sys
+import threading
+import urllib.parse
+
+ROOT = '/remote.php/webdav/'
+USERNAME = 'user'
+PASSWORD = 'secret'
+
+SYNC_TOKEN = 'http://example.com/ns/sync/1'
+NEXT_SYNC_TOKEN = 'http://example.com/ns/sync/2'
+
+# Photos comes with the missing properties first, file one.txt with
+# them last, and the name of the latter is percent-encoded.
+LISTING = '''<?xml version="1.0" encoding="utf-8"?>
+<d:multistatus xmlns:d="DAV:">
+  <d:response>
+    <d:href>/remote.php/webdav/</d:href>
+    <d:propstat>
+      <d:prop>
+        <d:getetag>"root"</d:getetag>
+        <d:resourcetype><d:collection/></d:resourcetype>
+      </d:prop>
+      <d:status>HTTP/1.1 200 OK</d:status>
+    </d:propstat>
+  </d:response>
+  <d:response>
+    <d:href>/remote.php/webdav/Photos/</d:href>
+    <d:propstat>
+      <d:prop>
+        <d:getcontenttype>application/octet-stream</d:getcontenttype>
+      </d:prop>
+      <d:status>HTTP/1.1 404 Not Found</d:status>
+    </d:propstat>
+    <d:propstat>
+      <d:prop>
+        <d:getetag>"photos"</d:getetag>
+        <d:getlastmodified>Tue, 05 Nov 2013 10:00:00 GMT</d:getlastmodified>
+        <d:resourcetype><d:collection/></d:resourcetype>
+      </d:prop>
+      <d:status>HTTP/1.1 200 OK</d:status>
+    </d:propstat>
+  </d:response>
+  <d:response>
+    <d:href>/remote.php/webdav/file%20one.txt</d:href>
+    <d:propstat>
+      <d:prop>
+        <d:getcontenttype>text/plain</d:getcontenttype>
+        <d:getetag>"file"</d:getetag>
+        <d:getlastmodified>Wed, 06 Nov 2013 12:30:00 GMT</d:getlastmodified>
+        <d:resourcetype/>
+      </d:prop>
+      <d:status>HTTP/1.1 200 OK</d:status>
+    </d:propstat>
+    <d:propstat>
+      <d:prop>
+        <d:quota-used-bytes/>
+      </d:prop>
+      <d:status>HTTP/1.1 404 Not Found</d:status>
+    </d:propstat>
+  </d:response>
+</d:multistatus>
+'''
+
+SYNC_TOKEN_RESPONSE = '''<?xml version="1.0" encoding="utf-8"?>
+<d:multistatus xmlns:d="DAV:">
+  <d:response>
+    <d:href>/remote.php/webdav/</d:href>
+    <d:propstat>
+      <d:prop>
+        <d:sync-token>%s</d:sync-token>
+      </d:prop>
+      <d:status>HTTP/1.1 200 OK</d:status>
+    </d:propstat>
+  </d:response>
+</d:multistatus>
+''' % SYNC_TOKEN
+
+# one changed member, below a sub-collection, and one removed member
+CHANGES = '''<?xml version="1.0" encoding="utf-8"?>
+<d:multistatus xmlns:d="DAV:">
+  <d:response>
+    <d:href>/remote.php/webdav/Photos/new%%20photo.jpg</d:href>
+    <d:propstat>
+      <d:prop>
+        <d:getcontenttype>image/jpeg</d:getcontenttype>
+        <d:getetag>"new"</d:getetag>
+        <d:getlastmodified>Thu, 07 Nov 2013 08:15:00 GMT</d:getlastmodified>
+        <d:resourcetype/>
+      </d:prop>
+      <d:status>HTTP/1.1 200 OK</d:status>
+    </d:propstat>
+  </d:response>
+  <d:response>
+    <d:href>/remote.php/webdav/old.txt</d:href>
+    <d:status>HTTP/1.1 404 Not Found</d:status>
+  </d:response>
+  <d:sync-token>%s</d:sync-token>
+</d:multistatus>
+''' % NEXT_SYNC_TOKEN
+
+
+TREE_PROPSTAT = '''    <d:propstat>
+      <d:prop>
+%s        <d:getetag>"%s"</d:getetag>
+        <d:getlastmodified>Wed, 06 Nov 2013 12:30:00 GMT</d:getlastmodified>
+        <d:resourcetype>%s</d:resourcetype>
+      </d:prop>
+      <d:status>HTTP/1.1 200 OK</d:status>
+    </d:propstat>
+'''
+
+
+class Tree:
+    """Directories are added breadth first, up to fan_out below each
+    one and depth below the root, and the files are spread evenly
+    over all of them."""
+
+    def __init__(self, n_files, n_dirs, depth, fan_out):
+        self.dirs = {'': []}
+        self.files = {'': 0}
+
+        queue = [('', 0)]
+        added = 0
+        while queue and added < n_dirs:
+            parent, level = queue.pop(0)
+            if level >= depth:
+                continue
+            for i in range(fan_out):
+                if added >= n_dirs:
+                    break
+                path = '%sdir%d/' % (parent, added)
+                self.dirs[parent].append(path)
+                self.dirs[path] = []
+                self.files[path] = 0
+                queue.append((path, level + 1))
+                added += 1
+
+        paths = sorted(self.dirs)
+        for i in range(n_files):
+            self.files[paths[i % len(paths)]] += 1
+
+    def response(self, path, is_dir):
+        href = urllib.parse.quote(ROOT + path)
+        if is_dir:
+            props = TREE_PROPSTAT % ('', 'd' + path, '<d:collection/>')
+        else:
+            props = TREE_PROPSTAT % ('        <d:getcontenttype>text/plain</d:getcontenttype>\n',
+                                     'f' + path, '')
+        return '  <d:response>\n    <d:href>%s</d:href>\n%s  </d:response>\n' % (href, props)
+
+    def listing(self, path):
+        if path not in self.dirs:
+            return None
+        parts = ['<?xml version="1.0" encoding="utf-8"?>\n<d:multistatus xmlns:d="DAV:">\n']
+        parts.append(self.response(path, True))
+        for child in self.dirs[path]:
+            parts.append(self.response(child, True))
+        for i in range(self.files[path]):
+            parts.append(self.response('%sfile %d.txt' % (path, i), False))
+        parts.append('</d:multistatus>\n')
+        return ''.join(parts)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+    def __init__(self, tree):
+        http.server.HTTPServer.__init__(self, ('127.0.0.1', 0), Handler)
+        self.tree = tree
+        self.lock = threading.Lock()
+        self.counts = {'PROPFIND': 0, 'REPORT': 0}
+
+    def count(self, method):
+        with self.lock:
+            self.counts[method] += 1
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        pass
+
+    def read_body(self):
+        length = int(self.headers.get('Content-Length', 0))
+        return self.rfile.read(length).decode('utf-8')
+
+    def send(self, status, body=''):
+        data = body.encode('utf-8')
+        self.send_response(status)
+        if status == 401:
+            self.send_header('WWW-Authenticate', 'Basic realm="ownCloud"')
+        if data:
+            self.send_header('Content-Type', 'application/xml; charset=utf-8')
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def authorized(self):
+        expected = base64.b64encode(('%s:%s' % (USERNAME, PASSWORD)).encode('utf-8')).decode('ascii')
+        return self.headers.get('Authorization') == 'Basic ' + expected
+
+    def do_PROPFIND(self):
+        body = self.read_body()
+        self.server.count('PROPFIND')
+        if not self.authorized():
+            self.send(401)
+        elif self.server.tree is not None:
+            self.tree_propfind(body)
+        elif self.path != ROOT:
+            self.send(404)
+        elif self.headers.get('Depth') == '0' and 'sync-token' in body:
+            self.send(207, SYNC_TOKEN_RESPONSE)
+        elif self.headers.get('Depth') == '1':
+            self.send(207, LISTING)
+        else:
+            self.send(400)
+
+    def tree_propfind(self, body):
+        path = urllib.parse.unquote(self.path)
+        listing = None
+        if path.startswith(ROOT):
+            listing = self.server.tree.listing(path[len(ROOT):])
+        if listing is None:
+            self.send(404)
+        elif self.headers.get('Depth') == '0' and 'sync-token' in body:
+            self.send(207, SYNC_TOKEN_RESPONSE)
+        elif self.headers.get('Depth') == '1':
+            self.send(207, listing)
+        else:
+            self.send(400)
+
+    def do_REPORT(self):
+        body = self.read_body()
+        self.server.count('REPORT')
+        if not self.authorized():
+            self.send(401)
+        elif self.server.tree is not None or self.path != ROOT:
+            self.send(404)
+        elif '<d:sync-token>%s</d:sync-token>' % SYNC_TOKEN in body:
+            self.send(207, CHANGES)
+        else:
+            # the DAV:valid-sync-token precondition
+            self.send(403)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--files', type=int, help='serve a generated tree with this many files')
+    parser.add_argument('--dirs', type=int, default=5000)
+    parser.add_argument('--depth', type=int, default=4)
+    parser.add_argument('--fan-out', type=int, default=20)
+    args = parser.parse_args()
+
+    tree = None
+    if args.files is not None:
+        tree = Tree(args.files, args.dirs, args.depth, args.fan_out)
+
+    server = Server(tree)
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+
+    print(server.server_address[1], flush=True)
+
+    sys.stdin.read()
+    server.shutdown()
+
+    if tree is not None:
+        print('dirs %d' % (len(tree.dirs) - 1))
+        print('files %d' % sum(tree.files.values()))
+        for method in sorted(server.counts):
+            print('%s %d' % (method.lower(), server.counts[method]))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()